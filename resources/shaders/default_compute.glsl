@@ -38,7 +38,8 @@ struct HitInfo
 
 //*************************************
 // Sparse Voxel 64-Tree Node structure
-// - PackedData[0]: Combines IsLeaf (highest bit) and ChildPtr (lower 31 bits).
+// - PackedData[0]: Combines IsLeaf (bit 31), IsSolid (bit 30) and ChildPtr (lower 30 bits). The ChildPtr
+//   of a solid node is the material that fills it.
 // - PackedData[1]: Lower 32 bits of ChildMask.
 // - PackedData[2]: Upper 32 bits of ChildMask.
 //
@@ -62,6 +63,7 @@ struct AABB
 // - Root: Root node of the tree
 // - NodePoolPtr: Offset into the NodePool buffer
 // - LeafDataPtr: Offset into the LeafData buffer
+// - RootScale: Scale of the root node (the tree spans 2^RootScale voxels per axis)
 // - AABB: Bounding box
 // - Transform: Transform matrix
 //
@@ -70,7 +72,8 @@ struct SparseVoxelTree
     Node Root;
     uint NodePoolPtr;
     uint LeafDataPtr;
-    uint _padding[3];
+    uint RootScale;
+    uint _padding[2];
     AABB Bounds;
     mat4 Transform;
 };
@@ -111,6 +114,7 @@ uint Popcnt64Below(uvec2 mask, uint bitIndex)
 
 // Node Utility Functions
 bool IsLeaf(in Node node);
+bool IsSolid(in Node node);
 uint ChildPtr(in Node node);
 uvec2 ChildMask(in Node node);
 
@@ -138,6 +142,12 @@ layout (location = 0) uniform vec2 ScreenSize;
 layout (location = 1) uniform vec3 ViewParams;
 // Camera world transformation matrix
 layout (location = 2) uniform mat4 CamWorldMatrix;
+// Deepest tree level to descend to (0 = root, RootScale / 2 = voxels). Occupied nodes at this level are
+// drawn as solid using their representative material. The root has no entry in NodeMaterials, so 1 is the
+// coarsest level drawn and 0 behaves like 1.
+layout (location = 3) uniform int MaxDepth;
+// Distance based level of detail: nodes smaller than LodBias pixels are not descended into. 0 disables it.
+layout (location = 4) uniform float LodBias;
 
 //*****************************************************************************
 // Buffers
@@ -165,6 +175,12 @@ layout(std430, binding = 3) buffer PaletteBuffer {
     vec4 Palette[];
 };
 
+// Representative material of every node, parallel to NodePool (binding = 4)
+layout(std430, binding = 4) buffer NodeMaterialBuffer
+{
+    uint NodeMaterials[];
+};
+
 //*****************************************************************************
 // Main
 //*****************************************************************************
@@ -218,14 +234,25 @@ bool IsLeaf(in Node node)
     return (node.PackedData[0] & 0x80000000u) != 0u;
 }
 
+//*************************************
+// IsSolid
+// - node: Node to test
+// - Returns: True if the node is filled with a single material
+//
+bool IsSolid(in Node node)
+{
+    // Bit 30 is the solid flag.
+    return (node.PackedData[0] & 0x40000000u) != 0u;
+}
+
 //*************************************
 // ChildPtr
 // - node: Node to get child pointer from
-// - Returns: Child pointer (lower 31 bits)
+// - Returns: Child pointer (lower 30 bits), or the material of a solid node
 //
 uint ChildPtr(in Node node)
 {
-    return node.PackedData[0] & 0x7FFFFFFFu;
+    return node.PackedData[0] & 0x3FFFFFFFu;
 }
 
 //*************************************
@@ -240,9 +267,11 @@ uvec2 ChildMask(in Node node)
 
 //*****************************************************************************
 // RayCast
-// Updated ray casting function that traverses the sparse voxel tree in integer voxel space.
-// This version assumes that the tree was built with an initial scale of 6 (i.e. a 64x64x64 volume)
-// and that the tree’s AABB.Min is at an integer position (e.g. (0,0,0)).
+// Hierarchical DDA through the sparse voxel tree in integer voxel space. Every step crosses a whole empty
+// cell of the deepest node holding the ray's voxel, and the path from the root is kept on a small stack so
+// leaving a node only ascends to the lowest ancestor holding the next voxel. The root node spans
+// 2^tree.RootScale voxels per axis, and the tree's AABB.Min is assumed to be at an integer position (e.g.
+// (0,0,0)). Mirrored on the CPU by SvtRayCaster::RayCast.
 //*****************************************************************************
 
 HitInfo RayCast(in Ray ray, in SparseVoxelTree tree)
@@ -265,91 +294,107 @@ HitInfo RayCast(in Ray ray, in SparseVoxelTree tree)
     vec3 rayPos = ray.Origin + t * ray.Direction;
 
     // --- Set up initial tree traversal parameters ---
-    // currentScale is 6 because 2^6 = 64, matching the voxel map size.
-    int currentScale = 6;
-    // Assume the tree's AABB.Min is at an integer coordinate (e.g., (0,0,0)).
-    ivec3 nodeOrigin = ivec3(boundsMin);
-    Node node = tree.Root;
+    // The root covers 2^RootScale voxels per axis, enough to contain the whole voxel map.
+    int rootScale = int(tree.RootScale);
+    ivec3 rootOrigin = ivec3(boundsMin);
+    ivec3 rootEnd = rootOrigin + ivec3(1 << rootScale);
+
+    // Nodes on the path from the root to the current node, which sits at depth `depth` and spans
+    // 2^(rootScale - 2 * depth) voxels
+    Node stack[16];
+    stack[0] = tree.Root;
+    int depth = 0;
+
+    // Voxel the ray is in, and the one it was in on the previous step
+    ivec3 ipos = clamp(ivec3(floor(rayPos)), rootOrigin, ivec3(boundsMax) - 1);
+    ivec3 lastPos = ipos;
+
+    // Size of a pixel at unit distance, for the distance based level of detail
+    float pixelSize = ViewParams.y / (ViewParams.z * ScreenSize.y);
 
     // --- Traverse along the ray (up to 256 steps) ---
     for (int i = 0; i < 256; i++)
     {
-        // Determine the size of the current node region.
-        int nodeSize = 1 << currentScale; // region covers [nodeOrigin, nodeOrigin + nodeSize)
-        ivec3 ipos = ivec3(floor(rayPos));
-        // If the current voxel position is outside the current node region, reset to root.
-        if (any(lessThan(ipos, nodeOrigin)) || any(greaterThanEqual(ipos, nodeOrigin + ivec3(nodeSize))))
+        // Ascend to the deepest node on the stack that still holds the voxel: a node at scale s holds every
+        // voxel that agrees with the previous one on all bits at or above s.
+        ivec3 diff = ipos ^ lastPos;
+        int commonScale = (findMSB(uint(diff.x | diff.y | diff.z)) + 2) & ~1;
+        depth = min(depth, (rootScale - commonScale) / 2);
+        lastPos = ipos;
+
+        // Stop at the level whose cells cover at least LodBias pixels at this distance
+        int depthLimit = MaxDepth;
+        float footprint = t * pixelSize * LodBias;
+        if (footprint > 1.0)
         {
-            node = tree.Root;
-            currentScale = 6;
-            nodeOrigin = ivec3(boundsMin);
+            depthLimit = min(depthLimit, (rootScale - int(log2(footprint))) / 2);
         }
 
-        // At the current level, each cell spans 2^(currentScale-2) voxels.
-        int shift = currentScale - 2;
-        ivec3 localCoord = ipos - nodeOrigin;
-        int cell_x = (localCoord.x >> shift) & 3;
-        int cell_y = (localCoord.y >> shift) & 3;
-        int cell_z = (localCoord.z >> shift) & 3;
+        // At the current level, each cell spans 2^shift voxels.
+        ivec3 localCoord = ipos - rootOrigin;
+        Node node = stack[depth];
+        int shift = rootScale - 2 * depth - 2;
+        ivec3 cell = (localCoord >> shift) & 3;
         // IMPORTANT: Use the same ordering as your CPU code: x + y*4 + z*16.
-        uint cellIndex = uint(cell_x + cell_y * 4 + cell_z * 16);
+        uint cellIndex = uint(cell.x + cell.y * 4 + cell.z * 16);
 
         // Descend the tree while a child exists for this cell.
-        while (!IsLeaf(node) && IsBitSet(ChildMask(node), cellIndex))
+        while (!IsLeaf(node) && !IsSolid(node) && IsBitSet(ChildMask(node), cellIndex))
         {
-            // Determine the child offset by counting the number of set bits below cellIndex.
+            // Determine the child offset by counting the number of set bits below cellIndex. Child pointers are
+            // relative to the tree's part of the shared buffers.
             uint childSlot = Popcnt64Below(ChildMask(node), cellIndex);
-            node = NodePool[ChildPtr(node) + childSlot];
-
-            // Update nodeOrigin for the child.
-            nodeOrigin += ivec3((int(cellIndex) & 3) << shift,
-                                ((int(cellIndex) >> 2) & 3) << shift,
-                                ((int(cellIndex) >> 4) & 3) << shift);
-            currentScale -= 2;
-            shift = currentScale - 2;
-
-            // Recompute local coordinates and cell index at the new level.
-            localCoord = ipos - nodeOrigin;
-            cell_x = (localCoord.x >> shift) & 3;
-            cell_y = (localCoord.y >> shift) & 3;
-            cell_z = (localCoord.z >> shift) & 3;
-            cellIndex = uint(cell_x + cell_y * 4 + cell_z * 16);
+            uint childIndex = tree.NodePoolPtr + ChildPtr(node) + childSlot;
+
+            // Past the depth limit the child is treated as solid
+            if (depth + 1 > depthLimit)
+            {
+                return HitInfo(true, Palette[NodeMaterials[childIndex]].rgb);
+            }
+
+            node = NodePool[childIndex];
+            depth++;
+            stack[depth] = node;
+
+            // Recompute the cell index at the new level.
+            shift -= 2;
+            cell = (localCoord >> shift) & 3;
+            cellIndex = uint(cell.x + cell.y * 4 + cell.z * 16);
+        }
+
+        // Solid nodes are hit anywhere inside of them.
+        if (IsSolid(node))
+        {
+            return HitInfo(true, Palette[ChildPtr(node)].rgb);
         }
 
         // Check for a hit: if we're at a leaf and the cell is set.
         if (IsLeaf(node) && IsBitSet(ChildMask(node), cellIndex))
         {
-            // Return a white hit.
-            return HitInfo(true, Palette[LeafData[ChildPtr(node) + Popcnt64Below(ChildMask(node), cellIndex)]].rgb);
+            return HitInfo(true, Palette[LeafData[tree.LeafDataPtr + ChildPtr(node) + Popcnt64Below(ChildMask(node), cellIndex)]].rgb);
         }
 
-        // --- Advance the ray using a standard voxel DDA step ---
-        vec3 cellMin = floor(rayPos);
-        vec3 tCandidate;
-        if (ray.Direction.x > 0.0)
-            tCandidate.x = (cellMin.x + 1.0 - rayPos.x) / ray.Direction.x;
-        else if (ray.Direction.x < 0.0)
-            tCandidate.x = (rayPos.x - cellMin.x) / -ray.Direction.x;
-        else
-            tCandidate.x = 1e30;
-        if (ray.Direction.y > 0.0)
-            tCandidate.y = (cellMin.y + 1.0 - rayPos.y) / ray.Direction.y;
-        else if (ray.Direction.y < 0.0)
-            tCandidate.y = (rayPos.y - cellMin.y) / -ray.Direction.y;
-        else
-            tCandidate.y = 1e30;
-        if (ray.Direction.z > 0.0)
-            tCandidate.z = (cellMin.z + 1.0 - rayPos.z) / ray.Direction.z;
-        else if (ray.Direction.z < 0.0)
-            tCandidate.z = (rayPos.z - cellMin.z) / -ray.Direction.z;
-        else
-            tCandidate.z = 1e30;
-
-        float dt = min(tCandidate.x, min(tCandidate.y, tCandidate.z));
-        t += dt + 0.0001;
-        if (t > tExit)
+        // --- Step across the whole empty cell ---
+        ivec3 cellMin = rootOrigin + ((localCoord >> shift) << shift);
+        ivec3 cellMax = cellMin + ivec3(1 << shift);
+        bvec3 positive = greaterThan(ray.Direction, vec3(0.0));
+        vec3 side = (mix(vec3(cellMin), vec3(cellMax), positive) - ray.Origin) * invDir;
+        side = mix(vec3(1e30), side, notEqual(ray.Direction, vec3(0.0)));
+
+        float tNext = min(side.x, min(side.y, side.z));
+        if (tNext > tExit)
             break;
+
+        // The next voxel is found in integers rather than by flooring a nudged position, so every step
+        // leaves the cell no matter how far along the ray it is.
+        t = max(t, tNext);
         rayPos = ray.Origin + t * ray.Direction;
+        ipos = clamp(ivec3(floor(rayPos)), cellMin, cellMax - 1);
+        vec3 nextCell = mix(vec3(cellMin - 1), vec3(cellMax), positive);
+        ipos = ivec3(mix(vec3(ipos), nextCell, equal(side, vec3(tNext))));
+
+        if (any(lessThan(ipos, rootOrigin)) || any(greaterThanEqual(ipos, rootEnd)))
+            break;
     }
 
     return HitInfo(false, vec3(0.0));
@@ -0,0 +1,6 @@
+#include "basic_sparse_voxel_tree.h"
+
+// The instantiations compared against SparseVoxelTree. Building them here also keeps the template compiled.
+template class BasicSparseVoxelTree<uint8_t, 4>;
+template class BasicSparseVoxelTree<uint16_t, 8>;
+template class BasicSparseVoxelTree<VoxelRGBA, 4>;
@@ -0,0 +1,334 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include <glm/glm.hpp>
+#include "bit_pack.h"
+#include "hierarchical_dda.h"
+#include "sparse_tree_builder.h"
+
+// RGBA voxel payload for BasicSparseVoxelTree. A voxel is empty when all channels are zero.
+struct VoxelRGBA
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    uint8_t a;
+
+    bool operator==(const VoxelRGBA&) const = default;
+};
+
+/**
+ * @brief Sparse 64-tree over an arbitrary voxel payload and leaf brick size.
+ *
+ * Internal nodes are the same as in SparseVoxelTree: each splits its region into 4x4x4 cells, with a 64-bit
+ * mask of the occupied ones and a contiguous array of children. Leaves are LeafSize^3 bricks:
+ *
+ * - With 4x4x4 leaves the occupancy mask fits in the node itself, and ChildPtr points at the brick's
+ *   non-empty voxels in leafData. This is the layout of SparseVoxelTree, and the default instantiation
+ *   BasicSparseVoxelTree<uint8_t, 4> produces the same nodes (minus the solid bit) and leafData as
+ *   SparseVoxelTree with SparseVoxelTreeOptions::CollapseSolid disabled.
+ * - Larger leaves keep their LeafSize^3-bit mask in a separate LeafBrick, which ChildPtr points at. The node's
+ *   ChildMask then holds one bit per 64-bit word of the brick mask, set if the word has any voxels.
+ *
+ * A voxel is empty when it equals Payload{}. Leaf scales are log2(LeafSize), and the root scale is the
+ * smallest leaf scale plus a multiple of 2 that covers the volume.
+ *
+ * SparseVoxelTree remains the tree used for rendering, editing and the other operations; this template covers
+ * building, lookups and ray casts so other payloads and brick sizes can be compared against it. Both trees are
+ * built by BuildSparseTree (sparse_tree_builder.h) and cast rays with TraverseHierarchicalDda
+ * (hierarchical_dda.h), so only the leaf layout lives here.
+*/
+template<typename Payload = uint8_t, int32_t LeafSize = 4>
+class BasicSparseVoxelTree
+{
+public:
+    static_assert(LeafSize >= 4 && std::has_single_bit(static_cast<uint32_t>(LeafSize)), "Leaves must be at least 4 voxels wide and a power of two");
+    // A leaf's ChildMask has one bit per 64-bit word of its brick mask
+    static_assert(LeafSize <= 16, "Leaves must be at most 16 voxels wide");
+
+    static constexpr int32_t LeafScale = std::countr_zero(static_cast<uint32_t>(LeafSize));
+    static constexpr int32_t LeafVoxels = LeafSize * LeafSize * LeafSize;
+    static constexpr int32_t LeafMaskWords = LeafVoxels / 64;
+    static constexpr int32_t MaxRootScale = 30;
+
+    struct [[gnu::packed]] Node
+    {
+        uint32_t IsLeaf : 1;     // Indicates if this node is a leaf brick.
+        uint32_t ChildPtr : 31;  // Offset of the child array, of the leaf's voxels (4x4x4 leaves) or of its LeafBrick.
+        uint64_t ChildMask;      // Occupied cells, or occupied words of the brick mask for larger leaves.
+    };
+
+    // Occupancy of a leaf larger than 4x4x4. Voxel i is bit i % 64 of Mask[i / 64], and its payload is stored at
+    // DataPtr + Prefix[i / 64] + the number of set bits below it in its word.
+    struct LeafBrick
+    {
+        uint64_t Mask[LeafMaskWords];
+        uint32_t Prefix[LeafMaskWords];
+        uint32_t DataPtr;
+    };
+
+    struct RayHit
+    {
+        bool Hit = false;
+        float Distance = 0.0f;
+        glm::ivec3 Voxel = glm::ivec3(0);
+        Payload Value = {};
+    };
+
+    // Builds the tree from a dense grid in x-fastest order, like VoxelMap::voxels.
+    BasicSparseVoxelTree(std::span<const Payload> voxels, glm::uvec3 size)
+    {
+        GenerateTree(voxels, size);
+    }
+
+    void GenerateTree(std::span<const Payload> voxels, glm::uvec3 size)
+    {
+        assert(voxels.size() >= static_cast<size_t>(size.x) * size.y * size.z);
+
+        nodePool.clear();
+        leafData.clear();
+        leafBricks.clear();
+
+        dimensions = size;
+        uint32_t maxSize = std::max({ size.x, size.y, size.z });
+        rootScale = LeafScale;
+        while ((1ull << rootScale) < maxSize)
+        {
+            rootScale += 2;
+        }
+        assert(rootScale <= MaxRootScale);
+
+        BuildSource source{ *this, voxels };
+        root = BuildSparseTree(source, rootScale, glm::ivec3(0, 0, 0), nodePool);
+    }
+
+    Payload At(int32_t x, int32_t y, int32_t z) const
+    {
+        uint32_t extent = 1u << rootScale;
+        if (static_cast<uint32_t>(x) >= extent || static_cast<uint32_t>(y) >= extent || static_cast<uint32_t>(z) >= extent)
+        {
+            return Payload{};
+        }
+
+        const Node* node = &root;
+        for (int32_t scale = rootScale - 2; !node->IsLeaf; scale -= 2)
+        {
+            int32_t index = ((x >> scale) & 3) | (((y >> scale) & 3) << 2) | (((z >> scale) & 3) << 4);
+            uint64_t bit = 1ull << index;
+            if (!(node->ChildMask & bit))
+            {
+                return Payload{};
+            }
+            node = &nodePool[node->ChildPtr + std::popcount(node->ChildMask & (bit - 1))];
+        }
+
+        int32_t slot = leafSlot(*node, leafIndex(x, y, z));
+        return slot >= 0 ? leafData[slot] : Payload{};
+    }
+
+    /**
+     * @brief Casts a ray through the volume and returns the first non-empty voxel it enters.
+     *
+     * The ray is clipped to the root region and walked with the hierarchical DDA shared with
+     * SparseVoxelTree::Raycast (see hierarchical_dda.h): every step crosses the whole empty cell of the deepest node holding the current
+     * voxel, so empty space is skipped a whole node at a time, and the next voxel is found in integers so every
+     * step makes progress no matter how far along the ray it is. Inside a leaf the ray steps one voxel at a time.
+     *
+     * Parameters:
+     * - origin, direction: The ray in voxel space. The direction does not need to be normalized.
+     * - maxDistance: Distance along the ray, in units of `direction`, after which the ray stops.
+    */
+    RayHit RayCast(glm::vec3 origin, glm::vec3 direction, float maxDistance = 1e30f) const
+    {
+        RayHit hit;
+        HierarchicalDdaRay ray;
+        if (!ClipRayToRoot(origin, direction, rootScale, maxDistance, ray))
+        {
+            return hit;
+        }
+
+        RayCastSource source{ *this };
+        HierarchicalDdaHit<Payload> ddaHit = TraverseHierarchicalDda(source, ray, rootScale);
+        if (ddaHit.Hit)
+        {
+            hit.Hit = true;
+            hit.Distance = ddaHit.Distance;
+            hit.Voxel = ddaHit.Voxel;
+            hit.Value = ddaHit.Material;
+        }
+        return hit;
+    }
+
+    int32_t GetRootScale() const { return rootScale; }
+    const glm::uvec3& GetDimensions() const { return dimensions; }
+
+    // Bytes used by the node pool, the leaf bricks and the voxel payloads
+    size_t GetMemoryUsage() const
+    {
+        return nodePool.size() * sizeof(Node) + leafBricks.size() * sizeof(LeafBrick) + leafData.size() * sizeof(Payload);
+    }
+
+private:
+    Node root;
+    std::vector<Node> nodePool;
+    std::vector<LeafBrick> leafBricks;
+    std::vector<Payload> leafData;
+
+    int32_t rootScale;
+    glm::uvec3 dimensions;
+
+    // Leaf generation for BuildSparseTree. Nodes outside the volume are empty, and nothing is collapsed.
+    struct BuildSource
+    {
+        using Node = BasicSparseVoxelTree::Node;
+        static constexpr int32_t LeafScale = BasicSparseVoxelTree::LeafScale;
+        static constexpr int32_t MaxDepth = (MaxRootScale - LeafScale) / 2;
+
+        BasicSparseVoxelTree& tree;
+        std::span<const Payload> voxels;
+
+        bool IsOccupied(int32_t, glm::ivec3 pos) const { return glm::all(glm::lessThan(glm::uvec3(pos), tree.dimensions)); }
+        Node GenerateLeaf(glm::ivec3 pos) { return tree.generateLeaf(voxels, pos); }
+        bool CollapseChildren(Node&, const Node*) const { return false; }
+    };
+
+    // Node access for TraverseHierarchicalDda. Empty cells inside a leaf are single voxels.
+    struct RayCastSource
+    {
+        using Node = const BasicSparseVoxelTree::Node*;
+        using Value = Payload;
+        static constexpr int32_t MaxDepth = (MaxRootScale - LeafScale) / 2;
+        static constexpr bool MonotonicSteps = true;
+        static constexpr bool TrackNormals = false;
+
+        const BasicSparseVoxelTree& tree;
+
+        Node Root() const { return &tree.root; }
+        void BeginStep(float) {}
+
+        HierarchicalDdaStep Visit(Node node, int32_t, glm::ivec3 pos, int32_t& shift, Node& child, Payload& value) const
+        {
+            if (node->IsLeaf)
+            {
+                int32_t slot = tree.leafSlot(*node, leafIndex(pos.x, pos.y, pos.z));
+                if (slot >= 0)
+                {
+                    value = tree.leafData[slot];
+                    return HierarchicalDdaStep::Hit;
+                }
+                shift = 0;
+                return HierarchicalDdaStep::Empty;
+            }
+
+            int32_t index = ((pos.x >> shift) & 3) | (((pos.y >> shift) & 3) << 2) | (((pos.z >> shift) & 3) << 4);
+            uint64_t bit = 1ull << index;
+            if (!(node->ChildMask & bit))
+            {
+                return HierarchicalDdaStep::Empty;
+            }
+            child = &tree.nodePool[node->ChildPtr + std::popcount(node->ChildMask & (bit - 1))];
+            return HierarchicalDdaStep::Descend;
+        }
+    };
+
+    static int32_t leafIndex(int32_t x, int32_t y, int32_t z)
+    {
+        constexpr int32_t Mask = LeafSize - 1;
+        return (x & Mask) | ((y & Mask) << LeafScale) | ((z & Mask) << (2 * LeafScale));
+    }
+
+    // Returns the leafData index of voxel `index` of a leaf, or -1 if it is empty
+    int32_t leafSlot(const Node& leaf, int32_t index) const
+    {
+        if constexpr (LeafMaskWords == 1)
+        {
+            uint64_t bit = 1ull << index;
+            return (leaf.ChildMask & bit) ? static_cast<int32_t>(leaf.ChildPtr + std::popcount(leaf.ChildMask & (bit - 1))) : -1;
+        }
+        else
+        {
+            const LeafBrick& brick = leafBricks[leaf.ChildPtr];
+            uint64_t word = brick.Mask[index >> 6];
+            uint64_t bit = 1ull << (index & 63);
+            return (word & bit) ? static_cast<int32_t>(brick.DataPtr + brick.Prefix[index >> 6] + std::popcount(word & (bit - 1))) : -1;
+        }
+    }
+
+    Node generateLeaf(std::span<const Payload> voxels, glm::ivec3 pos)
+    {
+        Node node = {};
+        node.IsLeaf = 1;
+
+        // Repack the brick's voxels, x fastest
+        Payload brick[LeafVoxels] = {};
+        for (int32_t i = 0; i < LeafVoxels; ++i)
+        {
+            int32_t x = pos.x + (i & (LeafSize - 1));
+            int32_t y = pos.y + ((i >> LeafScale) & (LeafSize - 1));
+            int32_t z = pos.z + (i >> (2 * LeafScale));
+            if (static_cast<uint32_t>(x) < dimensions.x && static_cast<uint32_t>(y) < dimensions.y && static_cast<uint32_t>(z) < dimensions.z)
+            {
+                brick[i] = voxels[x + y * static_cast<size_t>(dimensions.x) + z * static_cast<size_t>(dimensions.x) * dimensions.y];
+            }
+        }
+
+        // Byte payloads in 4x4x4 leaves take the same SIMD path as SparseVoxelTree
+        if constexpr (std::is_same_v<Payload, uint8_t> && LeafMaskWords == 1)
+        {
+            node.ChildMask = BitPack::PackBits64(brick);
+            BitPack::LeftPack(brick, node.ChildMask);
+            node.ChildPtr = leafData.size();
+            leafData.insert(leafData.end(), brick, brick + std::popcount(node.ChildMask));
+            return node;
+        }
+
+        uint64_t mask[LeafMaskWords] = {};
+        size_t dataPtr = leafData.size();
+        for (int32_t i = 0; i < LeafVoxels; ++i)
+        {
+            if (!(brick[i] == Payload{}))
+            {
+                mask[i >> 6] |= 1ull << (i & 63);
+                leafData.push_back(brick[i]);
+            }
+        }
+
+        if constexpr (LeafMaskWords == 1)
+        {
+            node.ChildMask = mask[0];
+            node.ChildPtr = dataPtr;
+        }
+        else
+        {
+            LeafBrick leafBrick = {};
+            leafBrick.DataPtr = dataPtr;
+            uint32_t prefix = 0;
+            for (int32_t w = 0; w < LeafMaskWords; ++w)
+            {
+                leafBrick.Mask[w] = mask[w];
+                leafBrick.Prefix[w] = prefix;
+                prefix += std::popcount(mask[w]);
+                node.ChildMask |= static_cast<uint64_t>(mask[w] != 0) << w;
+            }
+
+            if (node.ChildMask != 0)
+            {
+                node.ChildPtr = leafBricks.size();
+                leafBricks.push_back(leafBrick);
+            }
+        }
+        return node;
+    }
+};
+
+// Instantiated once in basic_sparse_voxel_tree.cpp
+extern template class BasicSparseVoxelTree<uint8_t, 4>;
+extern template class BasicSparseVoxelTree<uint16_t, 8>;
+extern template class BasicSparseVoxelTree<VoxelRGBA, 4>;
@@ -0,0 +1,155 @@
+#include "bit_pack.h"
+
+#if defined(__x86_64__)
+#define BIT_PACK_X86 1
+#include <immintrin.h>
+#endif
+
+namespace BitPack
+{
+    uint64_t PackBits64Scalar(const uint8_t* data)
+    {
+        uint64_t mask = 0;
+        for (int i = 0; i < 64; ++i)
+        {
+            if (data[i] != 0)
+            {
+                mask |= 1ull << i;
+            }
+        }
+        return mask;
+    }
+
+    void LeftPackScalar(uint8_t* data, uint64_t mask)
+    {
+        int writeIndex = 0;
+        for (int i = 0; i < 64; ++i)
+        {
+            if (mask & (1ull << i))
+            {
+                data[writeIndex++] = data[i];
+            }
+        }
+    }
+
+#ifdef BIT_PACK_X86
+
+    bool IsSSE2Supported()
+    {
+        return __builtin_cpu_supports("sse2");
+    }
+
+    bool IsAVX2Supported()
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    bool IsBMI2Supported()
+    {
+        return __builtin_cpu_supports("bmi2");
+    }
+
+    bool IsAVX512VBMI2Supported()
+    {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vbmi2");
+    }
+
+    __attribute__((target("sse2")))
+    uint64_t PackBits64SSE2(const uint8_t* data)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t mask = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * 16));
+            uint32_t zeros = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, zero)));
+            mask |= static_cast<uint64_t>(~zeros & 0xFFFFu) << (i * 16);
+        }
+        return mask;
+    }
+
+    __attribute__((target("avx2")))
+    uint64_t PackBits64AVX2(const uint8_t* data)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+        uint32_t zerosLo = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zero)));
+        uint32_t zerosHi = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zero)));
+        return ~(static_cast<uint64_t>(zerosHi) << 32 | zerosLo);
+    }
+
+    __attribute__((target("bmi2,popcnt")))
+    void LeftPackBMI2(uint8_t* data, uint64_t mask)
+    {
+        // Each 8 byte group is compacted with pext using its mask bits expanded to byte lanes. The 8 byte
+        // store never reaches past the group that was just read, so packing in place is safe.
+        uint8_t* out = data;
+        for (int i = 0; i < 8; ++i)
+        {
+            uint64_t bits = (mask >> (i * 8)) & 0xFF;
+            if (bits == 0)
+            {
+                continue;
+            }
+
+            uint64_t group;
+            __builtin_memcpy(&group, data + i * 8, sizeof(group));
+
+            uint64_t byteMask = _pdep_u64(bits, 0x0101010101010101ull) * 0xFF;
+            uint64_t packed = _pext_u64(group, byteMask);
+            __builtin_memcpy(out, &packed, sizeof(packed));
+            out += _mm_popcnt_u64(bits);
+        }
+    }
+
+    __attribute__((target("avx512f,avx512bw,avx512vbmi2")))
+    void LeftPackAVX512(uint8_t* data, uint64_t mask)
+    {
+        __m512i bytes = _mm512_loadu_si512(data);
+        _mm512_storeu_si512(data, _mm512_maskz_compress_epi8(mask, bytes));
+    }
+
+#else
+
+    bool IsSSE2Supported() { return false; }
+    bool IsAVX2Supported() { return false; }
+    bool IsBMI2Supported() { return false; }
+    bool IsAVX512VBMI2Supported() { return false; }
+
+    uint64_t PackBits64SSE2(const uint8_t* data) { return PackBits64Scalar(data); }
+    uint64_t PackBits64AVX2(const uint8_t* data) { return PackBits64Scalar(data); }
+    void LeftPackBMI2(uint8_t* data, uint64_t mask) { LeftPackScalar(data, mask); }
+    void LeftPackAVX512(uint8_t* data, uint64_t mask) { LeftPackScalar(data, mask); }
+
+#endif
+
+    using PackBits64Func = uint64_t (*)(const uint8_t*);
+    using LeftPackFunc = void (*)(uint8_t*, uint64_t);
+
+    static PackBits64Func SelectPackBits64()
+    {
+        if (IsAVX2Supported()) return PackBits64AVX2;
+        if (IsSSE2Supported()) return PackBits64SSE2;
+        return PackBits64Scalar;
+    }
+
+    static LeftPackFunc SelectLeftPack()
+    {
+        if (IsAVX512VBMI2Supported()) return LeftPackAVX512;
+        if (IsBMI2Supported()) return LeftPackBMI2;
+        return LeftPackScalar;
+    }
+
+    uint64_t PackBits64(const uint8_t* data)
+    {
+        static const PackBits64Func func = SelectPackBits64();
+        return func(data);
+    }
+
+    void LeftPack(uint8_t* data, uint64_t mask)
+    {
+        static const LeftPackFunc func = SelectLeftPack();
+        func(data, mask);
+    }
+}
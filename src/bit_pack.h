@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+
+// Kernels for turning a 4x4x4 tile of voxels into a 64-bit occupancy mask (PackBits64) and for
+// compacting the tile down to its non-empty voxels (LeftPack).
+//
+// PackBits64 and LeftPack pick the fastest variant supported by the running CPU on first use;
+// the individual variants are exposed so they can be compared against each other. Variants whose
+// Is*Supported() check returns false must not be called.
+
+namespace BitPack
+{
+    // Returns a mask with bit i set if data[i] != 0. `data` must point to 64 bytes.
+    uint64_t PackBits64(const uint8_t* data);
+
+    // Moves the bytes of `data` whose mask bit is set to the front, preserving their order.
+    // Bytes past the packed entries are left unspecified. `data` must point to 64 bytes.
+    void LeftPack(uint8_t* data, uint64_t mask);
+
+    // Portable fallbacks
+    uint64_t PackBits64Scalar(const uint8_t* data);
+    void LeftPackScalar(uint8_t* data, uint64_t mask);
+
+    // x86 variants
+    bool IsSSE2Supported();
+    bool IsAVX2Supported();
+    bool IsBMI2Supported();
+    bool IsAVX512VBMI2Supported();
+
+    uint64_t PackBits64SSE2(const uint8_t* data);      // _mm_movemask_epi8 over 4x16 bytes
+    uint64_t PackBits64AVX2(const uint8_t* data);      // _mm256_movemask_epi8 over 2x32 bytes
+    void LeftPackBMI2(uint8_t* data, uint64_t mask);   // _pext_u64 over 8 bytes at a time
+    void LeftPackAVX512(uint8_t* data, uint64_t mask); // vpcompressb over all 64 bytes
+}
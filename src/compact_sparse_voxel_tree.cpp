@@ -0,0 +1,284 @@
+#include "compact_sparse_voxel_tree.h"
+#include "hierarchical_dda.h"
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <unordered_map>
+
+CompactSparseVoxelTree::CompactSparseVoxelTree(const SparseVoxelTree& tree)
+    : rootScale(tree.rootScale), farPointerCount(0)
+{
+    // The extra words add about one entry per child array
+    words.reserve(tree.nodePool.size() + tree.nodePool.size() / 8);
+    links.reserve(words.capacity());
+    leafData.reserve(tree.leafData.size());
+
+    const SparseVoxelTreeNode& root = tree.root;
+    if (root.IsSolid)
+    {
+        rootMask = ~0ull;
+        rootLink = SolidFlag | root.ChildPtr;
+        rootPtr = 0;
+    }
+    else
+    {
+        rootMask = root.ChildMask;
+        rootLink = 0;
+        std::unordered_map<uint32_t, uint32_t> builtArrays;
+        std::unordered_map<uint32_t, uint32_t> builtLeaves;
+        rootPtr = root.ChildMask != 0 ? build(tree, root, rootScale, builtArrays, builtLeaves) : 0;
+    }
+}
+
+uint32_t CompactSparseVoxelTree::build(const SparseVoxelTree& tree, const SparseVoxelTreeNode& node, int32_t scale,
+                                      std::unordered_map<uint32_t, uint32_t>& builtArrays, std::unordered_map<uint32_t, uint32_t>& builtLeaves)
+{
+    int32_t count = std::popcount(node.ChildMask);
+    if (scale == 2)
+    {
+        // Only reached for a leaf root; other leaves are copied with their siblings below
+        uint32_t ptr = static_cast<uint32_t>(leafData.size());
+        leafData.insert(leafData.end(), tree.leafData.begin() + node.ChildPtr, tree.leafData.begin() + node.ChildPtr + count);
+        return ptr;
+    }
+
+    // Arrays shared between nodes (DAG mode) are laid out once. They still come before every node pointing
+    // at them, so back distances and far pointers stay valid.
+    if (auto it = builtArrays.find(node.ChildPtr); it != builtArrays.end())
+    {
+        return it->second;
+    }
+
+    const SparseVoxelTreeNode* children = tree.nodePool.data() + node.ChildPtr;
+    uint16_t childLinks[64];
+    uint32_t childPtrs[64];
+    uint32_t leafDataBase = static_cast<uint32_t>(leafData.size());
+    uint32_t farPointers[64];
+    int32_t farCount = 0;
+
+    // Voxels another array already laid out are reused. The base moves back to the earliest of them that stays
+    // in reach of the new voxels; the others are reached through a far pointer when that is smaller than a copy.
+    uint32_t newEnd = leafDataBase + 4096;
+    for (int32_t i = 0; i < count && scale == 4; ++i)
+    {
+        auto it = children[i].IsSolid ? builtLeaves.end() : builtLeaves.find(children[i].ChildPtr);
+        if (it != builtLeaves.end() && it->second + ValueMask >= newEnd)
+        {
+            leafDataBase = std::min(leafDataBase, it->second);
+        }
+    }
+
+    // Lay out the children's own arrays (or voxels) first
+    for (int32_t i = 0; i < count; ++i)
+    {
+        const SparseVoxelTreeNode& child = children[i];
+        if (child.IsSolid)
+        {
+            childLinks[i] = SolidFlag | child.ChildPtr;
+        }
+        else if (scale == 4)
+        {
+            uint32_t voxels = std::popcount(child.ChildMask);
+            auto it = builtLeaves.find(child.ChildPtr);
+            if (it != builtLeaves.end() && it->second + ValueMask >= newEnd)
+            {
+                childLinks[i] = static_cast<uint16_t>(it->second - leafDataBase);
+                continue;
+            }
+            if (it != builtLeaves.end() && voxels > sizeof(uint64_t) + sizeof(uint16_t))
+            {
+                childLinks[i] = FarFlag | farCount;
+                farPointers[farCount++] = it->second;
+                continue;
+            }
+            childLinks[i] = static_cast<uint16_t>(leafData.size() - leafDataBase);
+            builtLeaves.try_emplace(child.ChildPtr, static_cast<uint32_t>(leafData.size()));
+            leafData.insert(leafData.end(), tree.leafData.begin() + child.ChildPtr, tree.leafData.begin() + child.ChildPtr + voxels);
+        }
+        else
+        {
+            childPtrs[i] = build(tree, child, scale - 2, builtArrays, builtLeaves);
+        }
+    }
+
+    uint32_t ptr = static_cast<uint32_t>(words.size());
+    for (int32_t i = 0; i < count; ++i)
+    {
+        const SparseVoxelTreeNode& child = children[i];
+        if (scale > 4 && !child.IsSolid)
+        {
+            uint32_t distance = ptr + i - childPtrs[i];
+            if (distance <= ValueMask)
+            {
+                childLinks[i] = static_cast<uint16_t>(distance);
+            }
+            else
+            {
+                childLinks[i] = FarFlag | farCount;
+                farPointers[farCount++] = childPtrs[i];
+            }
+        }
+
+        words.push_back(child.IsSolid ? ~0ull : child.ChildMask);
+        links.push_back(childLinks[i]);
+    }
+
+    if (scale == 4)
+    {
+        words.push_back(leafDataBase);
+        links.push_back(0);
+    }
+    for (int32_t i = 0; i < farCount; ++i)
+    {
+        words.push_back(farPointers[i]);
+        links.push_back(0);
+    }
+    farPointerCount += farCount;
+
+    builtArrays.emplace(node.ChildPtr, ptr);
+    return ptr;
+}
+
+uint32_t CompactSparseVoxelTree::childArray(uint64_t mask, uint32_t ptr, uint32_t child, uint16_t link, int32_t scale) const
+{
+    // The leaf data base and far pointers follow the array the child is in
+    uint32_t arrayEnd = ptr + std::popcount(mask);
+    if (scale == 2)
+    {
+        if (link & FarFlag)
+        {
+            return static_cast<uint32_t>(words[arrayEnd + 1 + (link & ValueMask)]);
+        }
+        return static_cast<uint32_t>(words[arrayEnd]) + link;
+    }
+    if (link & FarFlag)
+    {
+        return static_cast<uint32_t>(words[arrayEnd + (link & ValueMask)]);
+    }
+    return child - link;
+}
+
+uint8_t CompactSparseVoxelTree::descend(glm::ivec3 pos) const
+{
+    if (rootLink & SolidFlag)
+    {
+        return rootLink & ValueMask;
+    }
+
+    uint64_t mask = rootMask;
+    uint32_t ptr = rootPtr;
+    for (int32_t scale = rootScale - 2; ; scale -= 2)
+    {
+        int32_t index = ((pos.x >> scale) & 3) | (((pos.y >> scale) & 3) << 2) | (((pos.z >> scale) & 3) << 4);
+        uint64_t bit = 1ull << index;
+        if (!(mask & bit))
+        {
+            return 0;
+        }
+
+        uint32_t child = ptr + std::popcount(mask & (bit - 1));
+        if (scale == 0)
+        {
+            return leafData[child];
+        }
+
+        // Start both loads of the child before decoding its link
+        uint64_t childMask = words[child];
+        uint16_t link = links[child];
+        if (link & SolidFlag)
+        {
+            return link & ValueMask;
+        }
+
+        ptr = childArray(mask, ptr, child, link, scale);
+        mask = childMask;
+    }
+}
+
+uint8_t CompactSparseVoxelTree::At(int32_t x, int32_t y, int32_t z) const
+{
+    // Coordinates outside of the root region are always empty
+    uint32_t extent = 1u << rootScale;
+    if (static_cast<uint32_t>(x) >= extent || static_cast<uint32_t>(y) >= extent || static_cast<uint32_t>(z) >= extent)
+    {
+        return 0;
+    }
+
+    return descend(glm::ivec3(x, y, z));
+}
+
+// Node access for TraverseHierarchicalDda: the stack holds the mask and child array of every node on the path
+struct CompactSparseVoxelTree::RayCastSource
+{
+    struct Node
+    {
+        uint64_t mask;
+        uint32_t ptr;
+    };
+    using Value = uint8_t;
+    static constexpr int32_t MaxDepth = SparseVoxelTree::MaxRootScale / 2;
+    static constexpr bool MonotonicSteps = true;
+    static constexpr bool TrackNormals = false;
+
+    const CompactSparseVoxelTree& tree;
+
+    Node Root() const { return { tree.rootMask, tree.rootPtr }; }
+    void BeginStep(float) {}
+
+    HierarchicalDdaStep Visit(const Node& node, int32_t, glm::ivec3 pos, int32_t& shift, Node& child, uint8_t& material) const
+    {
+        int32_t index = ((pos.x >> shift) & 3) | (((pos.y >> shift) & 3) << 2) | (((pos.z >> shift) & 3) << 4);
+        uint64_t bit = 1ull << index;
+        if (!(node.mask & bit))
+        {
+            return HierarchicalDdaStep::Empty;
+        }
+
+        uint32_t entry = node.ptr + std::popcount(node.mask & (bit - 1));
+        if (shift == 0)
+        {
+            material = tree.leafData[entry];
+            return HierarchicalDdaStep::Hit;
+        }
+
+        uint16_t link = tree.links[entry];
+        if (link & SolidFlag)
+        {
+            material = link & ValueMask;
+            return HierarchicalDdaStep::Hit;
+        }
+
+        child = { tree.words[entry], tree.childArray(node.mask, node.ptr, entry, link, shift) };
+        return HierarchicalDdaStep::Descend;
+    }
+};
+
+CompactSparseVoxelTree::RayHit CompactSparseVoxelTree::RayCast(glm::vec3 origin, glm::vec3 direction, float maxDistance) const
+{
+    RayHit hit;
+    HierarchicalDdaRay ray;
+    if (!ClipRayToRoot(origin, direction, rootScale, maxDistance, ray))
+    {
+        return hit;
+    }
+
+    if (rootLink & SolidFlag)
+    {
+        hit.Hit = true;
+        hit.Distance = ray.T;
+        hit.Voxel = ray.Voxel;
+        hit.Material = rootLink & ValueMask;
+        return hit;
+    }
+
+    RayCastSource source{ *this };
+    HierarchicalDdaHit<uint8_t> ddaHit = TraverseHierarchicalDda(source, ray, rootScale);
+    if (ddaHit.Hit)
+    {
+        hit.Hit = true;
+        hit.Distance = ddaHit.Distance;
+        hit.Voxel = ddaHit.Voxel;
+        hit.Material = ddaHit.Material;
+    }
+    return hit;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "sparse_voxel_tree.h"
+
+// Read-only copy of a SparseVoxelTree in a smaller node encoding, for CPU lookups and ray casts.
+//
+// Every node is split across two parallel arrays: its child mask as an aligned 8-byte word, and a 16-bit
+// link, so a node takes 10 bytes instead of the 12 of the packed SparseVoxelTreeNode and mask loads are never
+// unaligned. A link holds a solid flag, a far flag and a 14-bit value:
+//
+// - Solid nodes store their material in the value.
+// - Leaves store the offset of their voxels from the leaf data base of their child array. The base is kept in
+//   one extra word right after the array; the leaves of one array hold at most 4096 voxels. Leaves whose
+//   voxels were already laid out for another array set the far flag instead, unless a copy is smaller.
+// - Internal nodes store the distance back to their own child array. Arrays are laid out in post-order, so a
+//   node's children always come before it. Distances that do not fit in 14 bits set the far flag, and the
+//   value then indexes the far pointers stored right after the node's own array.
+//
+// Only nodes near the top of large trees and shared leaves need far pointers. Child arrays shared by
+// deduplicated trees are laid out once. The copy does not follow later edits of the tree.
+class CompactSparseVoxelTree
+{
+public:
+    struct RayHit
+    {
+        bool Hit = false;
+        float Distance = 0.0f;
+        glm::ivec3 Voxel = glm::ivec3(0);
+        uint8_t Material = 0;
+    };
+
+    explicit CompactSparseVoxelTree(const SparseVoxelTree& tree);
+
+    uint8_t At(int32_t x, int32_t y, int32_t z) const;
+
+    // Casts a ray through the volume and returns the first non-empty voxel it enters, with the same hierarchical
+    // DDA as SparseVoxelTree::Raycast (see hierarchical_dda.h).
+    RayHit RayCast(glm::vec3 origin, glm::vec3 direction, float maxDistance = 1e30f) const;
+
+    int32_t GetRootScale() const { return rootScale; }
+
+    // Number of child arrays and leaves reached through a far pointer
+    size_t GetFarPointerCount() const { return farPointerCount; }
+
+    // Bytes used by the mask words, links and leaf data
+    size_t GetMemoryUsage() const { return words.size() * sizeof(uint64_t) + links.size() * sizeof(uint16_t) + leafData.size(); }
+
+private:
+    static constexpr uint16_t SolidFlag = 0x8000;
+    static constexpr uint16_t FarFlag = 0x4000;
+    static constexpr uint16_t ValueMask = 0x3FFF;
+
+    // Child masks, plus the leaf data base after every array of leaves and the far pointers after that or
+    // after arrays of internal nodes. links has an entry (unused for the extra words) for each.
+    std::vector<uint64_t> words;
+    std::vector<uint16_t> links;
+    std::vector<uint8_t> leafData;
+
+    // The root's mask and link, and the start of its child array (or of its voxels if it is a leaf)
+    uint64_t rootMask;
+    uint16_t rootLink;
+    uint32_t rootPtr;
+
+    int32_t rootScale;
+    size_t farPointerCount;
+
+    // Lays out the node's child array after its children's, and returns its start. The maps hold where source
+    // arrays and leaves were already laid out.
+    uint32_t build(const SparseVoxelTree& tree, const SparseVoxelTreeNode& node, int32_t scale, std::unordered_map<uint32_t, uint32_t>& builtArrays,
+                   std::unordered_map<uint32_t, uint32_t>& builtLeaves);
+
+    // Returns the start of the child array (or voxels) of entry `child` of the array at `ptr` with `mask`, whose
+    // cells have scale `scale`
+    uint32_t childArray(uint64_t mask, uint32_t ptr, uint32_t child, uint16_t link, int32_t scale) const;
+
+    // Descends to the voxel at `pos` and returns its material
+    uint8_t descend(glm::ivec3 pos) const;
+
+    // Node access for the hierarchical DDA of RayCast
+    struct RayCastSource;
+};
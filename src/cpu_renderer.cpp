@@ -0,0 +1,148 @@
+#include "cpu_renderer.h"
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    // Spreads the low 16 bits of `v` out to the even bits
+    uint32_t spreadBits(uint32_t v)
+    {
+        v &= 0xFFFF;
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    }
+
+    uint8_t toUnorm8(float value)
+    {
+        return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+CpuRenderer::CpuRenderer(const std::vector<SparseVoxelTree>& trees, const std::vector<glm::vec4>& palette, uint32_t threadCount)
+    : caster(allocate(trees), palette), pool(threadCount), threadStats(pool.GetThreadCount()),
+      threadScratch(pool.GetThreadCount())
+{
+}
+
+VoxelTreeMemoryAllocator CpuRenderer::allocate(const std::vector<SparseVoxelTree>& trees)
+{
+    // Only packs the buffers; nothing is uploaded, so no OpenGL context is needed
+    VoxelTreeMemoryAllocator allocator;
+    allocator.Allocate(trees);
+    return allocator;
+}
+
+void CpuRenderer::buildTiles(uint32_t width, uint32_t height)
+{
+    uint32_t tilesX = (width + TileSize - 1) / TileSize;
+    uint32_t tilesY = (height + TileSize - 1) / TileSize;
+    if (tilesX == tileWidth && tilesY == tileHeight)
+    {
+        return;
+    }
+
+    tileWidth = tilesX;
+    tileHeight = tilesY;
+    tiles.clear();
+    tiles.reserve(static_cast<size_t>(tilesX) * tilesY);
+    for (uint32_t y = 0; y < tilesY; ++y)
+    {
+        for (uint32_t x = 0; x < tilesX; ++x)
+        {
+            tiles.push_back(glm::uvec2(x, y));
+        }
+    }
+
+    std::sort(tiles.begin(), tiles.end(), [](glm::uvec2 a, glm::uvec2 b)
+    {
+        return (spreadBits(a.x) | spreadBits(a.y) << 1) < (spreadBits(b.x) | spreadBits(b.y) << 1);
+    });
+
+    for (glm::uvec2& tile : tiles)
+    {
+        tile *= TileSize;
+    }
+}
+
+SvtRenderStats CpuRenderer::Render(Camera camera, uint32_t width, uint32_t height, std::vector<uint8_t>& image)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    camera.Aspect = static_cast<float>(width) / height;
+    SvtView view = SvtRayCaster::MakeView(camera, width, height);
+
+    buildTiles(width, height);
+    image.resize(static_cast<size_t>(width) * height * 4);
+    std::fill(threadStats.begin(), threadStats.end(), ThreadStats{ 0, 0 });
+
+    uint32_t treeCount = static_cast<uint32_t>(caster.GetTreeCount());
+    uint32_t blockWidth = SvtRayCaster::GetPacketSize() / 2;
+    pool.ParallelFor(static_cast<uint32_t>(tiles.size()), [&](uint32_t index, uint32_t thread)
+    {
+        ThreadStats& stats = threadStats[thread];
+        ThreadScratch& scratch = threadScratch[thread];
+        glm::uvec2 tileMin = tiles[index];
+        glm::uvec2 tileMax = glm::min(tileMin + TileSize, glm::uvec2(width, height));
+
+        // Rays go in blocks of blockWidth x 2 pixels, one packet each, so the rays of a packet stay close
+        scratch.Pixels.clear();
+        scratch.Rays.clear();
+        for (uint32_t blockY = tileMin.y; blockY < tileMax.y; blockY += 2)
+        {
+            for (uint32_t blockX = tileMin.x; blockX < tileMax.x; blockX += blockWidth)
+            {
+                for (uint32_t y = blockY; y < std::min(blockY + 2, tileMax.y); ++y)
+                {
+                    for (uint32_t x = blockX; x < std::min(blockX + blockWidth, tileMax.x); ++x)
+                    {
+                        scratch.Pixels.push_back(glm::uvec2(x, y));
+                        scratch.Rays.push_back(caster.GetPrimaryRay(view, x, y));
+                    }
+                }
+            }
+        }
+
+        size_t rayCount = scratch.Rays.size();
+        scratch.Hits.resize(rayCount);
+        scratch.Nearest.assign(rayCount, SvtHit());
+        for (uint32_t tree = 0; tree < treeCount; ++tree)
+        {
+            caster.RayCastPacket(scratch.Rays, scratch.Hits, view, tree);
+            for (size_t i = 0; i < rayCount; ++i)
+            {
+                const SvtHit& hit = scratch.Hits[i];
+                SvtHit& nearest = scratch.Nearest[i];
+                stats.Hits += hit.Hit;
+                stats.Steps += hit.Steps;
+                if (hit.Hit && (!nearest.Hit || hit.Distance < nearest.Distance))
+                {
+                    nearest = hit;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < rayCount; ++i)
+        {
+            const SvtHit& nearest = scratch.Nearest[i];
+            glm::vec3 albedo = nearest.Hit ? nearest.Color : caster.GetSkyColor(scratch.Rays[i].Direction);
+            uint8_t* pixel = &image[(static_cast<size_t>(scratch.Pixels[i].y) * width + scratch.Pixels[i].x) * 4];
+            pixel[0] = toUnorm8(albedo.r);
+            pixel[1] = toUnorm8(albedo.g);
+            pixel[2] = toUnorm8(albedo.b);
+            pixel[3] = 255;
+        }
+    });
+
+    SvtRenderStats result;
+    result.Rays = static_cast<uint64_t>(width) * height * treeCount;
+    for (const ThreadStats& stats : threadStats)
+    {
+        result.Hits += stats.Hits;
+        result.Steps += stats.Steps;
+    }
+    result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
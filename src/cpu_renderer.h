@@ -0,0 +1,61 @@
+#pragma once
+
+#include "svt_ray_caster.h"
+#include "work_stealing_pool.h"
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Renders SparseVoxelTrees on the CPU with SvtRayCaster, for thumbnails and previews on machines without a
+// GPU.
+//
+// The frame is split into TileSize x TileSize tiles ordered along a Morton curve, and the tiles are spread
+// over a WorkStealingPool. Each thread starts on its own run of neighbouring tiles, which keeps the nodes it
+// touches in its cache, and steals from the others once it is done. Every pixel shows the nearest hit over
+// all trees, like the compute shader would for each tree on its own. Within a tile the rays are cast as
+// SvtRayCaster packets of neighbouring pixels.
+class CpuRenderer
+{
+public:
+    // Same tile size as the compute shader's work groups
+    static constexpr uint32_t TileSize = 16;
+
+    // `palette` is indexed by material, as for SvtRayCaster. 0 threads uses one per hardware thread.
+    CpuRenderer(const std::vector<SparseVoxelTree>& trees, const std::vector<glm::vec4>& palette, uint32_t threadCount = 0);
+
+    // Renders the trees as seen from `camera` into `image`, resized to width x height RGBA8 pixels, row-major
+    // with row 0 first. The camera's aspect ratio is set to match the image.
+    SvtRenderStats Render(Camera camera, uint32_t width, uint32_t height, std::vector<uint8_t>& image);
+
+    uint32_t GetThreadCount() const { return pool.GetThreadCount(); }
+
+private:
+    struct alignas(64) ThreadStats
+    {
+        uint64_t Hits;
+        uint64_t Steps;
+    };
+
+    // Rays of the tile a thread is on
+    struct ThreadScratch
+    {
+        std::vector<glm::uvec2> Pixels;
+        std::vector<SvtRay> Rays;
+        std::vector<SvtHit> Hits;
+        std::vector<SvtHit> Nearest;
+    };
+
+    SvtRayCaster caster;
+    WorkStealingPool pool;
+    std::vector<ThreadStats> threadStats;
+    std::vector<ThreadScratch> threadScratch;
+
+    // Top left corner of every tile in Morton order, for the last rendered size
+    std::vector<glm::uvec2> tiles;
+    uint32_t tileWidth = 0;
+    uint32_t tileHeight = 0;
+
+    static VoxelTreeMemoryAllocator allocate(const std::vector<SparseVoxelTree>& trees);
+
+    void buildTiles(uint32_t width, uint32_t height);
+};
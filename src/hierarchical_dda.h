@@ -0,0 +1,222 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <glm/glm.hpp>
+
+// Hierarchical DDA shared by the ray casts of SparseVoxelTree, BasicSparseVoxelTree, CompactSparseVoxelTree and
+// SvtRayCaster. Every step descends from the deepest node on the path that still holds the current voxel, then
+// crosses the whole empty cell it ends up in, so open space costs a step per empty node rather than per voxel.
+// The next voxel is found in integers, past the exited faces, so every step makes progress no matter how far
+// along the ray it is.
+//
+// The trees only differ in how a node is stored and how its children are found, which the traversal leaves to
+// a source type:
+//
+// - Node: what the traversal keeps on its stack for each level of the path.
+// - Value: the payload of a hit.
+// - MaxDepth: the deepest level below the root, at most.
+// - MonotonicSteps: keep the axes the ray did not exit from moving against the ray when rounding puts the
+//   next voxel behind the current one. SvtRayCaster leaves this off to match default_compute.glsl.
+// - TrackNormals: compute the normal of the last face crossed.
+// - Root(): the root node.
+// - BeginStep(t): called at the start of every step with the distance along the ray.
+// - Visit(node, depth, local, shift, child, value): looks at the cell of `node` holding voxel `local`, whose
+//   children have scale `shift`. Returns Hit with `value` set, Descend with `child` set, or Empty. An empty
+//   cell smaller than 2^shift voxels (inside a leaf brick) lowers `shift` to its scale.
+
+// A ray already clipped to the root region, see ClipRayToRoot
+struct HierarchicalDdaRay
+{
+    glm::vec3 Origin;
+    glm::vec3 Direction;
+    float T;                           // Distance at which the ray enters Voxel
+    float TExit;                       // Distance past which the ray stops
+    glm::ivec3 Voxel;                  // First voxel, inside the root region
+    glm::ivec3 Normal = glm::ivec3(0); // Face the ray entered Voxel through, zero if it starts inside
+    uint32_t FirstStep = 0;            // Steps already taken, counted towards MaxSteps
+    uint32_t MaxSteps = UINT32_MAX;
+};
+
+template<typename Value>
+struct HierarchicalDdaHit
+{
+    bool Hit = false;
+    float Distance = 0.0f;
+    glm::ivec3 Voxel = glm::ivec3(0);
+    glm::ivec3 Normal = glm::ivec3(0);
+    Value Material = {};
+    uint32_t Steps = 0; // Steps taken, including FirstStep
+};
+
+enum class HierarchicalDdaStep
+{
+    Empty,
+    Descend,
+    Hit
+};
+
+// Clips a ray to the root region [0, 2^rootScale)^3 and finds its first voxel. Axes the ray is parallel to
+// only need the origin inside the slab. Returns false if the ray misses the region within maxDistance.
+inline bool ClipRayToRoot(glm::vec3 origin, glm::vec3 direction, int32_t rootScale, float maxDistance, HierarchicalDdaRay& ray)
+{
+    int32_t extent = 1 << rootScale;
+    float tEntry = 0.0f;
+    float tExit = maxDistance;
+    int32_t entryAxis = -1;
+    for (int32_t axis = 0; axis < 3; ++axis)
+    {
+        if (direction[axis] == 0.0f)
+        {
+            if (!(origin[axis] >= 0.0f && origin[axis] < static_cast<float>(extent)))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        float invDir = 1.0f / direction[axis];
+        float t1 = -origin[axis] * invDir;
+        float t2 = (static_cast<float>(extent) - origin[axis]) * invDir;
+        if (std::min(t1, t2) > tEntry)
+        {
+            tEntry = std::min(t1, t2);
+            entryAxis = axis;
+        }
+        tExit = std::min(tExit, std::max(t1, t2));
+    }
+
+    if (!(tEntry <= tExit))
+    {
+        return false;
+    }
+
+    ray.Origin = origin;
+    ray.Direction = direction;
+    ray.T = tEntry;
+    ray.TExit = tExit;
+    ray.Voxel = glm::clamp(glm::ivec3(glm::floor(origin + tEntry * direction)), glm::ivec3(0), glm::ivec3(extent - 1));
+    ray.Normal = glm::ivec3(0);
+    if (entryAxis >= 0)
+    {
+        ray.Voxel[entryAxis] = direction[entryAxis] > 0.0f ? 0 : extent - 1;
+        ray.Normal[entryAxis] = direction[entryAxis] > 0.0f ? -1 : 1;
+    }
+    return true;
+}
+
+// Walks `ray` through the tree of `source`, whose root spans 2^rootScale voxels from rootOrigin, and returns
+// the first voxel (or solid node) it enters
+template<typename Source>
+HierarchicalDdaHit<typename Source::Value> TraverseHierarchicalDda(Source& source, const HierarchicalDdaRay& ray, int32_t rootScale,
+                                                                   glm::ivec3 rootOrigin = glm::ivec3(0))
+{
+    using Node = typename Source::Node;
+    HierarchicalDdaHit<typename Source::Value> hit;
+    uint32_t extent = 1u << rootScale;
+    glm::vec3 invDir = 1.0f / ray.Direction;
+
+    // Nodes on the path from the root to the current node, which sits at depth `depth` and spans
+    // 2^(rootScale - 2 * depth) voxels. The extra entry takes the child a leaf never descends to.
+    Node stack[Source::MaxDepth + 2];
+    stack[0] = source.Root();
+    int32_t depth = 0;
+
+    glm::ivec3 pos = ray.Voxel;
+    glm::ivec3 lastPos = pos;
+    glm::ivec3 normal = ray.Normal;
+    float t = ray.T;
+
+    for (uint32_t step = ray.FirstStep; step < ray.MaxSteps; ++step)
+    {
+        // Ascend to the deepest node on the stack that still holds the voxel: a node at scale s holds every
+        // voxel that agrees with the previous one on all bits at or above s
+        uint32_t diff = static_cast<uint32_t>((pos.x ^ lastPos.x) | (pos.y ^ lastPos.y) | (pos.z ^ lastPos.z));
+        depth = std::min(depth, (rootScale - static_cast<int32_t>(std::bit_width(diff))) / 2);
+        lastPos = pos;
+        source.BeginStep(t);
+
+        // Descend until the voxel's cell is empty, or a voxel or solid node is found
+        glm::ivec3 local = pos - rootOrigin;
+        int32_t shift = rootScale - 2 * depth - 2;
+        HierarchicalDdaStep visit;
+        while ((visit = source.Visit(stack[depth], depth, local, shift, stack[depth + 1], hit.Material)) == HierarchicalDdaStep::Descend)
+        {
+            ++depth;
+            shift -= 2;
+        }
+
+        if (visit == HierarchicalDdaStep::Hit)
+        {
+            hit.Hit = true;
+            hit.Distance = t;
+            hit.Voxel = pos;
+            hit.Normal = normal;
+            hit.Steps = step + 1;
+            return hit;
+        }
+
+        // Step across the whole empty cell, 2^shift voxels wide
+        glm::ivec3 cellMin = rootOrigin + ((local >> shift) << shift);
+        glm::ivec3 cellMax = cellMin + (1 << shift);
+        glm::vec3 side;
+        for (int32_t axis = 0; axis < 3; ++axis)
+        {
+            if (ray.Direction[axis] > 0.0f)
+                side[axis] = (cellMax[axis] - ray.Origin[axis]) * invDir[axis];
+            else if (ray.Direction[axis] < 0.0f)
+                side[axis] = (cellMin[axis] - ray.Origin[axis]) * invDir[axis];
+            else
+                side[axis] = std::numeric_limits<float>::infinity();
+        }
+
+        float tNext = std::min(side.x, std::min(side.y, side.z));
+        if (tNext > ray.TExit)
+        {
+            hit.Steps = step + 1;
+            return hit;
+        }
+
+        // The next voxel is found in integers, past the exited faces. The other axes are clamped into the cell.
+        t = std::max(t, tNext);
+        glm::ivec3 next = glm::clamp(glm::ivec3(glm::floor(ray.Origin + t * ray.Direction)), cellMin, cellMax - 1);
+        if constexpr (Source::TrackNormals)
+        {
+            normal = glm::ivec3(0);
+        }
+        for (int32_t axis = 0; axis < 3; ++axis)
+        {
+            if (side[axis] == tNext)
+            {
+                next[axis] = ray.Direction[axis] > 0.0f ? cellMax[axis] : cellMin[axis] - 1;
+                if constexpr (Source::TrackNormals)
+                {
+                    if (normal == glm::ivec3(0))
+                    {
+                        normal[axis] = ray.Direction[axis] > 0.0f ? -1 : 1;
+                    }
+                }
+            }
+            else if constexpr (Source::MonotonicSteps)
+            {
+                if (ray.Direction[axis] > 0.0f)
+                    next[axis] = std::max(next[axis], pos[axis]);
+                else if (ray.Direction[axis] < 0.0f)
+                    next[axis] = std::min(next[axis], pos[axis]);
+            }
+        }
+        pos = next;
+
+        local = pos - rootOrigin;
+        if (static_cast<uint32_t>(local.x) >= extent || static_cast<uint32_t>(local.y) >= extent || static_cast<uint32_t>(local.z) >= extent)
+        {
+            hit.Steps = step + 1;
+            return hit;
+        }
+    }
+
+    hit.Steps = ray.MaxSteps;
+    return hit;
+}
@@ -109,6 +109,7 @@ int main()
     GLuint treeBuffer = allocator.GetTreeBuffer();
     GLuint nodePoolBuffer = allocator.GetNodePoolBuffer();
     GLuint leafDataBuffer = allocator.GetLeafDataBuffer();
+    GLuint nodeMaterialBuffer = allocator.GetNodeMaterialBuffer();
 
     // Palette here
     GLuint paletteSSBO;
@@ -159,11 +160,16 @@ int main()
         computeShader.setVec3("ViewParams", glm::vec3(planeWidth, planeHeight, camera.NearClipPlane));
         computeShader.setMat4("CamWorldMatrix", camera.GetCameraToWorldMatrix());
 
+        // Level of detail: no depth cutoff and no distance based cutoff
+        computeShader.setInt("MaxDepth", SparseVoxelTree::MaxRootScale / 2);
+        computeShader.setFloat("LodBias", 0.0f);
+
         // Bind buffers
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, treeBuffer);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, nodePoolBuffer);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, leafDataBuffer);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, paletteSSBO);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, nodeMaterialBuffer);
 
         // Bind texture as image
         texture.bindAsImage(0, 0, GL_FALSE, GL_READ_WRITE, GL_RGBA32F);
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Post-order builder shared by SparseVoxelTree and BasicSparseVoxelTree. Leaves are visited in Morton order and
+// every node's children are appended to the node pool as one array once its last leaf has been visited, so a
+// node's array always follows the arrays of its children. Empty regions are skipped a whole node at a time.
+//
+// The trees only differ in their node and leaf layout, which the builder leaves to a source type:
+//
+// - Node: the node type, with a ChildMask and ChildPtr.
+// - LeafScale: log2 of a leaf's width.
+// - MaxDepth: the most levels of internal nodes above a leaf, at most.
+// - IsOccupied(level, pos): whether the node starting at `pos` with scale LeafScale + 2 * level may hold any
+//   voxels. Level 0 is a leaf.
+// - GenerateLeaf(pos): builds the leaf at `pos`, storing its voxels. Leaves with an empty ChildMask are dropped.
+// - CollapseChildren(node, children): may turn `node` into a single node standing for its children, returning
+//   true if it did, in which case the children are not stored.
+
+// Builds the node at `pos` with scale `scale`, appending the child arrays below it to nodePool
+template<typename Source>
+typename Source::Node BuildSparseTree(Source& source, int32_t scale, glm::ivec3 pos, std::vector<typename Source::Node>& nodePool)
+{
+    using Node = typename Source::Node;
+    if (scale == Source::LeafScale)
+    {
+        return source.GenerateLeaf(pos);
+    }
+
+    // Depth 0 is the node being generated and depth `leafDepth` its leaves. Every open internal node collects
+    // its children in a fixed 64-entry scratch array until its last leaf has been visited.
+    int32_t leafDepth = (scale - Source::LeafScale) / 2;
+
+    Node scratch[Source::MaxDepth][64];
+    uint64_t scratchMasks[Source::MaxDepth] = {};
+    int32_t scratchCounts[Source::MaxDepth] = {};
+
+    // Visit the leaves in Morton order: cells[k] is the cell index at depth leafDepth - k, so cells[0] is the
+    // leaf's index in its parent. One counter per level keeps this exact for every root scale, where a single
+    // Morton index would need 6 * leafDepth bits.
+    int32_t cells[Source::MaxDepth] = {};
+    for (bool done = false; !done; )
+    {
+        glm::ivec3 leafPos = pos;
+        for (int32_t level = 0; level < leafDepth; ++level)
+        {
+            int32_t index = cells[level];
+            leafPos += glm::ivec3((index & 3), ((index >> 2) & 3), ((index >> 4) & 3)) << (Source::LeafScale + 2 * level);
+        }
+
+        // Skip the largest empty node that starts at this leaf, or generate the leaf if it is occupied
+        int32_t level = 0;
+        while (level + 1 < leafDepth && cells[level] == 0)
+        {
+            ++level;
+        }
+        while (level >= 0 && source.IsOccupied(level, leafPos))
+        {
+            --level;
+        }
+
+        if (level < 0)
+        {
+            Node node = source.GenerateLeaf(leafPos);
+            if (node.ChildMask != 0)
+            {
+                scratch[leafDepth - 1][scratchCounts[leafDepth - 1]++] = node;
+                scratchMasks[leafDepth - 1] |= 1ull << cells[0];
+            }
+            level = 0;
+        }
+
+        // Step to the next cell at this level. Every counter that wraps around closes the node at depth
+        // leafDepth - 1 - level, whose last child has now been visited, deepest first.
+        for (; ++cells[level] == 64; ++level)
+        {
+            int32_t depth = leafDepth - 1 - level;
+            if (depth == 0)
+            {
+                done = true;
+                break;
+            }
+
+            if (scratchMasks[depth] != 0)
+            {
+                Node node = {};
+                node.ChildMask = scratchMasks[depth];
+                if (!source.CollapseChildren(node, scratch[depth]))
+                {
+                    node.ChildPtr = nodePool.size();
+                    nodePool.insert(nodePool.end(), scratch[depth], scratch[depth] + scratchCounts[depth]);
+                }
+
+                scratch[depth - 1][scratchCounts[depth - 1]++] = node;
+                scratchMasks[depth - 1] |= 1ull << cells[level + 1];
+            }
+            scratchMasks[depth] = 0;
+            scratchCounts[depth] = 0;
+            cells[level] = 0;
+        }
+    }
+
+    Node node = {};
+    node.ChildMask = scratchMasks[0];
+    if (!source.CollapseChildren(node, scratch[0]))
+    {
+        node.ChildPtr = nodePool.size();
+        nodePool.insert(nodePool.end(), scratch[0], scratch[0] + scratchCounts[0]);
+    }
+
+    return node;
+}
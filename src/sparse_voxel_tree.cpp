@@ -1,18 +1,108 @@
 #include "sparse_voxel_tree.h"
+#include "bit_pack.h"
+#include "hierarchical_dda.h"
+#include "sparse_tree_builder.h"
+#include "work_stealing_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdio>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <thread>
 
+// Compiles to a single popcnt instruction when built with -mpopcnt (see HW_POPCNT in the Makefile).
 inline int popcount64(uint64_t x)
 {
-    x = x - ((x >> 1) & 0x5555555555555555);
-    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
-    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0F;
-    x = x + (x >> 8);
-    x = x + (x >> 16);
-    x = x + (x >> 32);
-    return x & 0x7F;
+    return std::popcount(x);
 }
 
-SparseVoxelTree::SparseVoxelTree(const VoxelMap& voxelMap)
+// Packs the number of set bits below each 16-bit chunk of `mask` into one byte per chunk.
+inline uint32_t computeRank(uint64_t mask)
+{
+    uint32_t count0 = std::popcount(static_cast<uint16_t>(mask));
+    uint32_t count1 = count0 + std::popcount(static_cast<uint16_t>(mask >> 16));
+    uint32_t count2 = count1 + std::popcount(static_cast<uint16_t>(mask >> 32));
+    return (count0 << 8) | (count1 << 16) | (count2 << 24);
+}
+
+// Returns the smallest even scale whose node region covers every dimension of the voxel map.
+inline int32_t computeRootScale(uint32_t size_x, uint32_t size_y, uint32_t size_z)
+{
+    uint32_t maxSize = std::max({ size_x, size_y, size_z });
+
+    int32_t scale = SparseVoxelTree::MinRootScale;
+    while ((1u << scale) < maxSize)
+    {
+        scale += 2;
+    }
+
+    assert(scale <= SparseVoxelTree::MaxRootScale);
+    return scale;
+}
+
+inline int32_t computeRootScale(const VoxelMap& voxelMap)
+{
+    return computeRootScale(voxelMap.size_x, voxelMap.size_y, voxelMap.size_z);
+}
+
+// Encodes the cell index of a position at every level below the root, root level first, into a single key.
+// Sorting by this key orders positions the way the builder visits them (a Morton order). The key takes
+// 3 * rootScale bits, so it only fits for root scales up to 21.
+inline uint64_t cellPath(int32_t x, int32_t y, int32_t z, int32_t rootScale)
+{
+    uint64_t path = 0;
+    for (int32_t scale = rootScale - 2; scale >= 0; scale -= 2)
+    {
+        path = (path << 6) | ((x >> scale) & 3) | (((y >> scale) & 3) << 2) | (((z >> scale) & 3) << 4);
+    }
+    return path;
+}
+
+// Stable LSD radix sort on the lower `keyBits` bits of each item's `path`, 8 bits per pass.
+template<typename T>
+void radixSortByPath(std::vector<T>& items, int32_t keyBits)
+{
+    std::vector<T> sorted(items.size());
+    for (int32_t shift = 0; shift < keyBits; shift += 8)
+    {
+        size_t offsets[257] = {};
+        for (const T& item : items)
+        {
+            ++offsets[((item.path >> shift) & 0xFF) + 1];
+        }
+        for (int32_t digit = 0; digit < 256; ++digit)
+        {
+            offsets[digit + 1] += offsets[digit];
+        }
+        for (const T& item : items)
+        {
+            sorted[offsets[(item.path >> shift) & 0xFF]++] = item;
+        }
+        items.swap(sorted);
+    }
+}
+
+// Header of the files written by GenerateTreeStreaming, followed by nodeCount nodes and leafDataCount bytes of leaf data
+struct SparseVoxelTreeFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t rootScale;
+    uint32_t dimensions[3];
+    uint64_t nodeCount;
+    uint64_t leafDataCount;
+    SparseVoxelTreeNode root;
+};
+
+constexpr char SparseVoxelTreeFileMagic[4] = { 'S', 'V', 'T', 'F' };
+constexpr uint32_t SparseVoxelTreeFileVersion = 1;
+
+SparseVoxelTree::SparseVoxelTree(const VoxelMap& voxelMap, const SparseVoxelTreeOptions& options)
+    : options(options)
 {
     // Initialize AABB to cover the entire voxel map
     AABBMin = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -25,209 +115,2966 @@ SparseVoxelTree::SparseVoxelTree(const VoxelMap& voxelMap)
     GenerateTree(voxelMap);
 }
 
-void SparseVoxelTree::GenerateTree(const VoxelMap& voxelMap)
+SparseVoxelTree::SparseVoxelTree(const SparseVoxelList& voxelList, const SparseVoxelTreeOptions& options)
+    : options(options)
+{
+    // Initialize AABB to cover the entire volume
+    AABBMin = glm::vec3(0.0f, 0.0f, 0.0f);
+    AABBMax = glm::vec3(voxelList.size_x, voxelList.size_y, voxelList.size_z);
+
+    // Initialize transform to identity
+    Transform = glm::mat4(1.0f);
+
+    // Generate the tree
+    GenerateTree(voxelList);
+}
+
+SparseVoxelTree::SparseVoxelTree(const std::string& path, const SparseVoxelTreeOptions& options)
+    : options(options)
+{
+    // Load the tree
+    LoadTree(path);
+
+    // Initialize AABB to cover the entire volume
+    AABBMin = glm::vec3(0.0f, 0.0f, 0.0f);
+    AABBMax = glm::vec3(dimensions);
+
+    // Initialize transform to identity
+    Transform = glm::mat4(1.0f);
+}
+
+void SparseVoxelTree::GenerateTree(const VoxelMap& voxelMap)
+{
+    // Clear existing data
+    clearPools();
+
+    // Size the root to cover the whole voxel map
+    rootScale = computeRootScale(voxelMap);
+    dimensions = glm::uvec3(voxelMap.size_x, voxelMap.size_y, voxelMap.size_z);
+
+    // Count the occupied nodes and voxels up front so the pools are allocated once
+    OccupancyPyramid occupancy;
+    occupancy.Build(voxelMap, rootScale);
+    nodePool.reserve(occupancy.CountNodes());
+    leafData.reserve(occupancy.voxelCount);
+
+    // Start generating the tree from the root
+    root = generateTree(voxelMap, occupancy, rootScale, glm::ivec3(0, 0, 0), nodePool, leafData);
+    finishTree();
+}
+
+void SparseVoxelTree::GenerateTree(const SparseVoxelList& voxelList)
+{
+    // Clear existing data
+    clearPools();
+
+    // Size the root to cover the whole volume
+    rootScale = computeRootScale(voxelList.size_x, voxelList.size_y, voxelList.size_z);
+    dimensions = glm::uvec3(voxelList.size_x, voxelList.size_y, voxelList.size_z);
+
+    if (rootScale > 21)
+    {
+        throw std::runtime_error("Sparse voxel lists are limited to 2^21 voxels per axis.");
+    }
+
+    // Sort the voxels into the order the recursive builder visits them
+    struct Entry
+    {
+        uint64_t path;
+        uint8_t material;
+    };
+
+    std::vector<Entry> entries;
+    entries.reserve(voxelList.voxels.size());
+    for (const SparseVoxel& voxel : voxelList.voxels)
+    {
+        if (voxel.material != 0 && voxel.x < voxelList.size_x && voxel.y < voxelList.size_y && voxel.z < voxelList.size_z)
+        {
+            entries.push_back({ cellPath(voxel.x, voxel.y, voxel.z, rootScale), voxel.material });
+        }
+    }
+    radixSortByPath(entries, 3 * rootScale);
+
+    // Emit leaves in order while keeping the children of every open internal node on a per-depth stack.
+    // A node is closed (its children appended to nodePool) as soon as a leaf outside of it arrives, which
+    // appends child arrays in exactly the same post-order as the recursive builder.
+    int32_t leafDepth = rootScale / 2 - 1;
+    std::vector<std::vector<SparseVoxelTreeNode>> openChildren(leafDepth);
+    std::vector<uint64_t> openMasks(leafDepth, 0);
+
+    auto closeNode = [&](int32_t depth, uint64_t path)
+    {
+        SparseVoxelTreeNode node = {};
+        node.ChildMask = openMasks[depth];
+        if (!collapseChildren(node, openChildren[depth].data()))
+        {
+            node.ChildPtr = nodePool.size();
+            nodePool.insert(nodePool.end(), openChildren[depth].begin(), openChildren[depth].end());
+        }
+        openChildren[depth].clear();
+        openMasks[depth] = 0;
+
+        int32_t index = (path >> (6 * (leafDepth + 1 - depth))) & 63;
+        openChildren[depth - 1].push_back(node);
+        openMasks[depth - 1] |= 1ull << index;
+    };
+
+    root = {};
+    root.IsLeaf = leafDepth == 0;
+    root.ChildPtr = 0;
+
+    size_t lastPath = 0;
+    for (size_t begin = 0; begin < entries.size(); )
+    {
+        uint64_t leafPath = entries[begin].path >> 6;
+
+        // Gather the voxels of this leaf; for duplicate positions the last entry in the list wins
+        SparseVoxelTreeNode leaf = {};
+        leaf.IsLeaf = 1;
+        leaf.ChildPtr = leafData.size();
+
+        size_t end = begin;
+        for (; end < entries.size() && (entries[end].path >> 6) == leafPath; ++end)
+        {
+            uint64_t bit = 1ull << (entries[end].path & 63);
+            if (leaf.ChildMask & bit)
+            {
+                leafData.back() = entries[end].material;
+                continue;
+            }
+            leaf.ChildMask |= bit;
+            leafData.push_back(entries[end].material);
+        }
+        collapseLeaf(leaf, leafData);
+
+        if (leafDepth == 0)
+        {
+            root = leaf;
+            break;
+        }
+
+        // Close the nodes of the previous leaf's path that do not contain this leaf, deepest first
+        if (begin != 0)
+        {
+            int32_t depth = leafDepth - 1;
+            while (depth > 0 && (lastPath >> (6 * (leafDepth + 1 - depth))) != (entries[begin].path >> (6 * (leafDepth + 1 - depth))))
+            {
+                --depth;
+            }
+            for (int32_t closing = leafDepth - 1; closing > depth; --closing)
+            {
+                closeNode(closing, lastPath);
+            }
+        }
+
+        openChildren[leafDepth - 1].push_back(leaf);
+        openMasks[leafDepth - 1] |= 1ull << (leafPath & 63);
+
+        lastPath = entries[begin].path;
+        begin = end;
+    }
+
+    if (leafDepth > 0)
+    {
+        if (!entries.empty())
+        {
+            for (int32_t closing = leafDepth - 1; closing > 0; --closing)
+            {
+                closeNode(closing, lastPath);
+            }
+        }
+
+        root.ChildMask = openMasks[0];
+        if (!collapseChildren(root, openChildren[0].data()))
+        {
+            root.ChildPtr = nodePool.size();
+            nodePool.insert(nodePool.end(), openChildren[0].begin(), openChildren[0].end());
+        }
+    }
+
+    finishTree();
+}
+
+void SparseVoxelTree::GenerateTreeParallel(const VoxelMap& voxelMap, uint32_t threadCount)
+{
+    // Clear existing data
+    clearPools();
+
+    // Size the root to cover the whole voxel map
+    rootScale = computeRootScale(voxelMap);
+    dimensions = glm::uvec3(voxelMap.size_x, voxelMap.size_y, voxelMap.size_z);
+
+    OccupancyPyramid occupancy;
+    occupancy.Build(voxelMap, rootScale);
+    nodePool.reserve(occupancy.CountNodes());
+    leafData.reserve(occupancy.voxelCount);
+
+    // Trees whose root children are leaves are too small to be worth splitting
+    if (rootScale <= 4)
+    {
+        root = generateTree(voxelMap, occupancy, rootScale, glm::ivec3(0, 0, 0), nodePool, leafData);
+        finishTree();
+        return;
+    }
+
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = std::min(threadCount, 64u);
+
+    // Each child of the root is built into its own pools, with pointers relative to those pools
+    struct Subtree
+    {
+        SparseVoxelTreeNode node;
+        std::vector<SparseVoxelTreeNode> nodePool;
+        std::vector<uint8_t> leafData;
+    };
+
+    int32_t childScale = rootScale - 2;
+    std::vector<Subtree> subtrees(64);
+    std::atomic<int32_t> nextChild(0);
+
+    auto worker = [&]()
+    {
+        for (int32_t i = nextChild++; i < 64; i = nextChild++)
+        {
+            glm::ivec3 childPos = glm::ivec3((i & 3), ((i >> 2) & 3), ((i >> 4) & 3));
+            Subtree& subtree = subtrees[i];
+            subtree.node = generateTree(voxelMap, occupancy, childScale, childPos << childScale, subtree.nodePool, subtree.leafData);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < threadCount; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // Stitch the subtrees together in the same order the serial builder appends them,
+    // so the resulting pools are identical to GenerateTree.
+
+    root = {};
+    std::vector<SparseVoxelTreeNode> children;
+
+    for (int32_t i = 0; i < 64; ++i)
+    {
+        Subtree& subtree = subtrees[i];
+        if (subtree.node.ChildMask == 0)
+        {
+            continue;
+        }
+
+        uint32_t nodeBase = nodePool.size();
+        uint32_t leafBase = leafData.size();
+
+        for (SparseVoxelTreeNode node : subtree.nodePool)
+        {
+            if (!node.IsSolid)
+            {
+                node.ChildPtr += node.IsLeaf ? leafBase : nodeBase;
+            }
+            nodePool.push_back(node);
+        }
+        leafData.insert(leafData.end(), subtree.leafData.begin(), subtree.leafData.end());
+
+        SparseVoxelTreeNode child = subtree.node;
+        if (!child.IsSolid)
+        {
+            child.ChildPtr += child.IsLeaf ? leafBase : nodeBase;
+        }
+
+        root.ChildMask |= 1ull << i;
+        children.push_back(child);
+
+        // Release the subtree's memory as soon as it has been copied
+        subtree = Subtree();
+    }
+
+    if (!collapseChildren(root, children.data()))
+    {
+        root.ChildPtr = nodePool.size();
+        nodePool.insert(nodePool.end(), children.begin(), children.end());
+    }
+    finishTree();
+}
+
+void SparseVoxelTree::GenerateTreeStreaming(glm::uvec3 size, const SparseVoxelSlabReader& readSlab, const std::string& path,
+                                            const SparseVoxelTreeOptions& options, uint32_t slabDepth)
+{
+    assert(slabDepth > 0 && slabDepth % 4 == 0);
+
+    int32_t rootScale = computeRootScale(size.x, size.y, size.z);
+
+    // Nodes are written to the tree file after room for the header, and leaf data to a temporary file
+    // that is appended once the node pool is complete
+    std::string leafDataPath = path + ".leafdata";
+    std::ofstream file(path, std::ios::binary);
+    std::fstream leafFile(leafDataPath, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+    if (!file || !leafFile)
+    {
+        throw std::runtime_error("Failed to open file.");
+    }
+
+    SparseVoxelTreeFileHeader header = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint64_t nodeCount = 0;
+    uint64_t leafDataCount = 0;
+    auto reserve = [](uint64_t& count, uint64_t entries)
+    {
+        if (count + entries > (1ull << 30))
+        {
+            throw std::runtime_error("Tree exceeds the 2^30 pool entries addressable by ChildPtr.");
+        }
+        uint32_t ptr = static_cast<uint32_t>(count);
+        count += entries;
+        return ptr;
+    };
+
+    // Open nodes of every level above the leaves, as one row covering the volume's x and y extent. Level 0
+    // holds the nodes at scale 4 (whose children are leaves), the last level the root.
+    struct OpenLevel
+    {
+        uint32_t sizeX;
+        std::vector<uint64_t> masks;
+        std::vector<SparseVoxelTreeNode> children; // 64 per node, indexed by cell
+    };
+
+    int32_t levelCount = rootScale / 2 - 1;
+    std::vector<OpenLevel> levels(levelCount);
+    for (int32_t level = 0; level < levelCount; ++level)
+    {
+        int32_t scale = 4 + 2 * level;
+        levels[level].sizeX = (size.x + (1u << scale) - 1) >> scale;
+        size_t count = static_cast<size_t>(levels[level].sizeX) * ((size.y + (1u << scale) - 1) >> scale);
+        levels[level].masks.assign(count, 0);
+        levels[level].children.resize(count * 64);
+    }
+
+    SparseVoxelTreeNode root = {};
+    root.IsLeaf = rootScale == 2;
+
+    // Adds a finished node to its open parent; `cell` is the node's position divided by its size
+    auto addNode = [&](const SparseVoxelTreeNode& node, int32_t scale, glm::uvec3 cell)
+    {
+        if (scale == rootScale)
+        {
+            root = node;
+            return;
+        }
+
+        OpenLevel& parent = levels[scale / 2 - 1];
+        size_t slot = (cell.x >> 2) + static_cast<size_t>(cell.y >> 2) * parent.sizeX;
+        int32_t index = (cell.x & 3) | ((cell.y & 3) << 2) | ((cell.z & 3) << 4);
+        parent.masks[slot] |= 1ull << index;
+        parent.children[slot * 64 + index] = node;
+    };
+
+    // Writes the children of every open node of a level and adds the nodes to the level above
+    auto closeLevel = [&](int32_t level, uint32_t cellZ)
+    {
+        OpenLevel& open = levels[level];
+        int32_t scale = 4 + 2 * level;
+        for (size_t slot = 0; slot < open.masks.size(); ++slot)
+        {
+            uint64_t mask = open.masks[slot];
+            if (mask == 0)
+            {
+                continue;
+            }
+            open.masks[slot] = 0;
+
+            SparseVoxelTreeNode* cells = open.children.data() + slot * 64;
+            SparseVoxelTreeNode node = {};
+            node.ChildMask = mask;
+
+            bool solid = options.CollapseSolid && mask == ~0ull;
+            for (int32_t i = 0; solid && i < 64; ++i)
+            {
+                solid = cells[i].IsSolid && cells[i].ChildPtr == cells[0].ChildPtr;
+            }
+
+            if (solid)
+            {
+                node = makeSolid(scale, static_cast<uint8_t>(cells[0].ChildPtr));
+            }
+            else
+            {
+                // Compact the children into their final order in place
+                int32_t count = 0;
+                for (uint64_t bits = mask; bits != 0; bits &= bits - 1)
+                {
+                    cells[count++] = cells[std::countr_zero(bits)];
+                }
+                node.ChildPtr = reserve(nodeCount, count);
+                file.write(reinterpret_cast<const char*>(cells), count * sizeof(SparseVoxelTreeNode));
+            }
+
+            addNode(node, scale, glm::uvec3(slot % open.sizeX, slot / open.sizeX, cellZ));
+        }
+    };
+
+    uint32_t tilesX = (size.x + 3) / 4;
+    uint32_t tilesY = (size.y + 3) / 4;
+    uint32_t tilesZ = (size.z + 3) / 4;
+    size_t sliceSize = static_cast<size_t>(size.x) * size.y;
+    std::vector<uint8_t> slab(sliceSize * slabDepth);
+
+    for (uint32_t slabZ = 0; slabZ < size.z; slabZ += slabDepth)
+    {
+        uint32_t depth = std::min(slabDepth, size.z - slabZ);
+        readSlab(slabZ, depth, std::span<uint8_t>(slab.data(), sliceSize * depth));
+
+        for (uint32_t tileZ = slabZ / 4; tileZ < tilesZ && tileZ * 4 < slabZ + depth; ++tileZ)
+        {
+            for (uint32_t tileY = 0; tileY < tilesY; ++tileY)
+            {
+                for (uint32_t tileX = 0; tileX < tilesX; ++tileX)
+                {
+                    // Repack voxels into 4x4x4 tile
+                    alignas(64) uint8_t temp[64] = { 0 };
+                    for (int32_t i = 0; i < 64; ++i)
+                    {
+                        uint32_t x = tileX * 4 + (i & 3);
+                        uint32_t y = tileY * 4 + ((i >> 2) & 3);
+                        uint32_t z = tileZ * 4 + ((i >> 4) & 3);
+                        if (x < size.x && y < size.y && z < size.z)
+                        {
+                            temp[i] = slab[x + y * static_cast<size_t>(size.x) + (z - slabZ) * sliceSize];
+                        }
+                    }
+
+                    SparseVoxelTreeNode leaf = {};
+                    leaf.IsLeaf = 1;
+                    leaf.ChildMask = PackBits64(temp);
+                    if (leaf.ChildMask == 0)
+                    {
+                        continue;
+                    }
+
+                    if (options.CollapseSolid && leaf.ChildMask == ~0ull && std::all_of(temp, temp + 64, [&](uint8_t voxel) { return voxel == temp[0]; }))
+                    {
+                        leaf = makeSolid(2, temp[0]);
+                    }
+                    else
+                    {
+                        LeftPack(temp, leaf.ChildMask);
+                        int32_t count = popcount64(leaf.ChildMask);
+                        leaf.ChildPtr = reserve(leafDataCount, count);
+                        leafFile.write(reinterpret_cast<const char*>(temp), count);
+                    }
+
+                    addNode(leaf, 2, glm::uvec3(tileX, tileY, tileZ));
+                }
+            }
+
+            // Close the levels whose nodes end at this tile layer, deepest first
+            for (int32_t level = 0; level < levelCount; ++level)
+            {
+                uint32_t tilesPerNode = 1u << (2 * (level + 1));
+                if ((tileZ + 1) % tilesPerNode != 0 && tileZ + 1 != tilesZ)
+                {
+                    break;
+                }
+                closeLevel(level, tileZ / tilesPerNode);
+            }
+        }
+    }
+
+    // Append the leaf data and fill in the header
+    leafFile.seekg(0);
+    std::vector<char> buffer(1 << 20);
+    while (leafFile.read(buffer.data(), buffer.size()) || leafFile.gcount() > 0)
+    {
+        file.write(buffer.data(), leafFile.gcount());
+    }
+    leafFile.close();
+    std::remove(leafDataPath.c_str());
+
+    std::copy(std::begin(SparseVoxelTreeFileMagic), std::end(SparseVoxelTreeFileMagic), header.magic);
+    header.version = SparseVoxelTreeFileVersion;
+    header.rootScale = rootScale;
+    header.dimensions[0] = size.x;
+    header.dimensions[1] = size.y;
+    header.dimensions[2] = size.z;
+    header.nodeCount = nodeCount;
+    header.leafDataCount = leafDataCount;
+    header.root = root;
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (!file)
+    {
+        throw std::runtime_error("Failed to write file.");
+    }
+}
+
+void SparseVoxelTree::LoadTree(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open file.");
+    }
+
+    SparseVoxelTreeFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        !std::equal(std::begin(SparseVoxelTreeFileMagic), std::end(SparseVoxelTreeFileMagic), header.magic) ||
+        header.version != SparseVoxelTreeFileVersion)
+    {
+        throw std::runtime_error("Failed to parse sparse voxel tree file.");
+    }
+
+    clearPools();
+    nodePool.resize(header.nodeCount);
+    leafData.resize(header.leafDataCount);
+    if (!file.read(reinterpret_cast<char*>(nodePool.data()), nodePool.size() * sizeof(SparseVoxelTreeNode)) ||
+        !file.read(reinterpret_cast<char*>(leafData.data()), leafData.size()))
+    {
+        throw std::runtime_error("Failed to read file.");
+    }
+
+    root = header.root;
+    rootScale = header.rootScale;
+    dimensions = glm::uvec3(header.dimensions[0], header.dimensions[1], header.dimensions[2]);
+    finishTree();
+}
+
+void SparseVoxelTree::clearPools()
+{
+    nodePool.clear();
+    leafData.clear();
+    nodeRanks.clear();
+    nodeMaterials.clear();
+    nodeVoxelCounts.clear();
+    nodeAggregates.clear();
+    clearFreeLists();
+    clearArrayIndex();
+}
+
+void SparseVoxelTree::clearFreeLists()
+{
+    for (int32_t i = 0; i <= 64; ++i)
+    {
+        freeNodeBlocks[i].clear();
+        freeLeafDataBlocks[i].clear();
+    }
+}
+
+void SparseVoxelTree::clearArrayIndex()
+{
+    sharesArrays = false;
+    nodeReferences.clear();
+    leafDataReferences.clear();
+    nodeArrays.clear();
+    leafArrays.clear();
+}
+
+void SparseVoxelTree::finishTree()
+{
+    if (options.Hollow)
+    {
+        Hollow();
+    }
+
+    voxelCount = countVoxels(root, rootScale);
+
+    if (options.Deduplicate)
+    {
+        std::vector<SparseVoxelTreeNode> newNodePool;
+        std::vector<uint8_t> newLeafData;
+        std::unordered_map<std::string, uint32_t> leafCache;
+        std::unordered_map<std::string, uint32_t> nodeCache;
+
+        root = deduplicate(root, newNodePool, newLeafData, leafCache, nodeCache);
+        nodePool = std::move(newNodePool);
+        leafData = std::move(newLeafData);
+        clearFreeLists();
+        nodePool.shrink_to_fit();
+        leafData.shrink_to_fit();
+
+        sharesArrays = true;
+        indexArrays();
+    }
+
+    if (options.Layout != SparseVoxelTreeLayout::PostOrder)
+    {
+        Reorder(options.Layout);
+    }
+
+    if (options.BuildLod)
+    {
+        BuildLodTable();
+    }
+    if (options.BuildAggregates)
+    {
+        BuildAggregateTable();
+    }
+}
+
+void SparseVoxelTree::Reorder(SparseVoxelTreeLayout layout)
+{
+    if (root.IsLeaf || root.IsSolid || root.ChildMask == 0)
+    {
+        return;
+    }
+
+    // New offset of every child array, indexed by its old offset. Arrays shared between nodes (DAG mode)
+    // are only placed once.
+    constexpr uint32_t Unplaced = UINT32_MAX;
+    std::vector<uint32_t> nodeOffsets(nodePool.size(), Unplaced);
+    std::vector<SparseVoxelTreeNode> newNodePool;
+    newNodePool.reserve(nodePool.size());
+
+    // Old index of every new node, so the tables move along with the nodes
+    std::vector<uint32_t> sources;
+
+    auto placeChildren = [&](const SparseVoxelTreeNode& node)
+    {
+        if (nodeOffsets[node.ChildPtr] == Unplaced)
+        {
+            uint32_t count = popcount64(node.ChildMask);
+            nodeOffsets[node.ChildPtr] = newNodePool.size();
+            newNodePool.insert(newNodePool.end(), nodePool.begin() + node.ChildPtr, nodePool.begin() + node.ChildPtr + count);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                sources.push_back(node.ChildPtr + i);
+            }
+        }
+    };
+
+    // All leaves are at the same depth, so a node's children are either all leaves or all internal
+    auto hasInternalChildren = [&](const SparseVoxelTreeNode& node)
+    {
+        return !nodePool[node.ChildPtr].IsLeaf;
+    };
+
+    // Visits the internal nodes `depth` levels below `node`
+    std::function<void(const SparseVoxelTreeNode&, int32_t, const std::function<void(const SparseVoxelTreeNode&)>&)> forEachAtDepth =
+        [&](const SparseVoxelTreeNode& node, int32_t depth, const std::function<void(const SparseVoxelTreeNode&)>& visit)
+    {
+        // Solid nodes have no child arrays to place
+        if (node.IsSolid)
+        {
+            return;
+        }
+        if (depth == 0)
+        {
+            visit(node);
+            return;
+        }
+        if (!hasInternalChildren(node))
+        {
+            return;
+        }
+        for (int32_t i = 0; i < popcount64(node.ChildMask); ++i)
+        {
+            forEachAtDepth(nodePool[node.ChildPtr + i], depth - 1, visit);
+        }
+    };
+
+    std::function<void(const SparseVoxelTreeNode&)> postOrder = [&](const SparseVoxelTreeNode& node)
+    {
+        if (node.IsSolid || nodeOffsets[node.ChildPtr] != Unplaced)
+        {
+            return;
+        }
+        if (hasInternalChildren(node))
+        {
+            for (int32_t i = 0; i < popcount64(node.ChildMask); ++i)
+            {
+                postOrder(nodePool[node.ChildPtr + i]);
+            }
+        }
+        placeChildren(node);
+    };
+
+    std::function<void(const SparseVoxelTreeNode&)> preOrder = [&](const SparseVoxelTreeNode& node)
+    {
+        if (node.IsSolid || nodeOffsets[node.ChildPtr] != Unplaced)
+        {
+            return;
+        }
+        placeChildren(node);
+        if (hasInternalChildren(node))
+        {
+            for (int32_t i = 0; i < popcount64(node.ChildMask); ++i)
+            {
+                preOrder(nodePool[node.ChildPtr + i]);
+            }
+        }
+    };
+
+    // `height` is the number of levels of child arrays in the subtree below `node`
+    std::function<void(const SparseVoxelTreeNode&, int32_t)> vanEmdeBoas = [&](const SparseVoxelTreeNode& node, int32_t height)
+    {
+        if (height == 1)
+        {
+            placeChildren(node);
+            return;
+        }
+
+        int32_t topHeight = height / 2;
+        vanEmdeBoas(node, topHeight);
+        forEachAtDepth(node, topHeight, [&](const SparseVoxelTreeNode& bottom) { vanEmdeBoas(bottom, height - topHeight); });
+    };
+
+    int32_t height = rootScale / 2 - 1;
+    switch (layout)
+    {
+    case SparseVoxelTreeLayout::PostOrder:
+        postOrder(root);
+        break;
+    case SparseVoxelTreeLayout::BreadthFirst:
+        for (int32_t depth = 0; depth < height; ++depth)
+        {
+            forEachAtDepth(root, depth, placeChildren);
+        }
+        break;
+    case SparseVoxelTreeLayout::DepthFirst:
+        preOrder(root);
+        break;
+    case SparseVoxelTreeLayout::VanEmdeBoas:
+        vanEmdeBoas(root, height);
+        break;
+    }
+
+    // Remap the child pointers, and lay out leafData in the order the leaves now appear
+    std::vector<uint32_t> leafOffsets(leafData.size(), Unplaced);
+    std::vector<uint8_t> newLeafData;
+    newLeafData.reserve(leafData.size());
+
+    for (SparseVoxelTreeNode& node : newNodePool)
+    {
+        if (node.IsSolid)
+        {
+            continue;
+        }
+        if (!node.IsLeaf)
+        {
+            node.ChildPtr = nodeOffsets[node.ChildPtr];
+            continue;
+        }
+
+        if (leafOffsets[node.ChildPtr] == Unplaced)
+        {
+            leafOffsets[node.ChildPtr] = newLeafData.size();
+            newLeafData.insert(newLeafData.end(), leafData.begin() + node.ChildPtr, leafData.begin() + node.ChildPtr + popcount64(node.ChildMask));
+        }
+        node.ChildPtr = leafOffsets[node.ChildPtr];
+    }
+    root.ChildPtr = nodeOffsets[root.ChildPtr];
+
+    nodePool = std::move(newNodePool);
+    leafData = std::move(newLeafData);
+    clearFreeLists();
+
+    // The keys of the array index hold child pointers, so it is rebuilt rather than remapped
+    if (sharesArrays)
+    {
+        indexArrays();
+    }
+
+    if (HasRankTable())
+    {
+        BuildRankTable();
+    }
+    remapTables(sources);
+}
+
+void SparseVoxelTree::Hollow()
+{
+    std::vector<SparseVoxelTreeNode> newNodePool;
+    std::vector<uint8_t> newLeafData;
+    newNodePool.reserve(nodePool.size());
+    newLeafData.reserve(leafData.size());
+
+    // Old index of every new node whose subtree was left as it was, so its table entries can be kept
+    std::vector<uint32_t> sources;
+    bool hasTables = HasLodTable() || HasAggregateTable();
+
+    // The new pools are built from the old tree, so every neighbor test sees the original occupancy
+    root = hollowNode(root, rootScale, glm::ivec3(0, 0, 0), newNodePool, newLeafData, hasTables ? &sources : nullptr);
+    if (root.ChildMask == 0)
+    {
+        root = {};
+        root.IsLeaf = rootScale == 2;
+    }
+
+    nodePool = std::move(newNodePool);
+    leafData = std::move(newLeafData);
+    clearFreeLists();
+    voxelCount = countVoxels(root, rootScale);
+
+    clearArrayIndex();
+
+    if (HasRankTable())
+    {
+        BuildRankTable();
+    }
+    remapTables(sources);
+}
+
+// Returns the occupancy mask of the 4x4x4 tile at `pos`: full inside solid nodes, empty outside the root region
+uint64_t SparseVoxelTree::tileMask(glm::ivec3 pos) const
+{
+    uint32_t extent = 1u << rootScale;
+    if (static_cast<uint32_t>(pos.x) >= extent || static_cast<uint32_t>(pos.y) >= extent || static_cast<uint32_t>(pos.z) >= extent)
+    {
+        return 0;
+    }
+
+    const SparseVoxelTreeNode* node = &root;
+    for (int32_t scale = rootScale - 2; ; scale -= 2)
+    {
+        if (node->IsSolid || node->IsLeaf)
+        {
+            return node->ChildMask;
+        }
+
+        int32_t index = ((pos.x >> scale) & 3) | (((pos.y >> scale) & 3) << 2) | (((pos.z >> scale) & 3) << 4);
+        if (!(node->ChildMask & (1ull << index)))
+        {
+            return 0;
+        }
+        node = &nodePool[node->ChildPtr + childSlot(*node, index)];
+    }
+}
+
+SparseVoxelTreeNode SparseVoxelTree::hollowNode(const SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 pos, std::vector<SparseVoxelTreeNode>& newNodePool,
+                                                std::vector<uint8_t>& newLeafData, std::vector<uint32_t>* sources) const
+{
+    SparseVoxelTreeNode result = node;
+    if (node.IsSolid)
+    {
+        return result;
+    }
+
+    if (node.IsLeaf)
+    {
+        // Voxels at the given x, y or z within the tile
+        constexpr uint64_t X0 = 0x1111111111111111ull, X3 = X0 << 3;
+        constexpr uint64_t Y0 = 0x000F000F000F000Full, Y3 = Y0 << 12;
+
+        // Move the neighbor of every voxel in one direction onto the voxel, taking the voxels past the tile's
+        // face from the adjacent tile
+        auto plusX = [](uint64_t m, uint64_t next) { return ((m >> 1) & ~X3) | ((next << 3) & X3); };
+        auto minusX = [](uint64_t m, uint64_t prev) { return ((m << 1) & ~X0) | ((prev >> 3) & X0); };
+        auto plusY = [](uint64_t m, uint64_t next) { return ((m >> 4) & ~Y3) | ((next << 12) & Y3); };
+        auto minusY = [](uint64_t m, uint64_t prev) { return ((m << 4) & ~Y0) | ((prev >> 12) & Y0); };
+        auto plusZ = [](uint64_t m, uint64_t next) { return (m >> 16) | (next << 48); };
+        auto minusZ = [](uint64_t m, uint64_t prev) { return (m << 16) | (prev >> 48); };
+
+        // A voxel is interior if its whole 3x3x3 neighborhood is occupied, computed as an erosion along x, then
+        // y, then z over the tile and its 26 neighbors. Requiring edge and corner neighbors as well as faces
+        // leaves a shell that rays cannot slip through at the edge between two diagonal surface voxels.
+        auto erode = [&](const uint64_t (&masks)[3][3][3])
+        {
+            uint64_t alongX[3][3];
+            for (int32_t z = 0; z < 3; ++z)
+            {
+                for (int32_t y = 0; y < 3; ++y)
+                {
+                    uint64_t m = masks[z][y][1];
+                    alongX[z][y] = m & plusX(m, masks[z][y][2]) & minusX(m, masks[z][y][0]);
+                }
+            }
+
+            uint64_t alongY[3];
+            for (int32_t z = 0; z < 3; ++z)
+            {
+                uint64_t m = alongX[z][1];
+                alongY[z] = m & plusY(m, alongX[z][2]) & minusY(m, alongX[z][0]);
+            }
+
+            uint64_t m = alongY[1];
+            return m & plusZ(m, alongY[2]) & minusZ(m, alongY[0]);
+        };
+
+        // Assume the adjacent tiles are full first, and only look them up if that leaves interior voxels
+        uint64_t masks[3][3][3];
+        std::fill(&masks[0][0][0], &masks[0][0][0] + 27, ~0ull);
+        masks[1][1][1] = node.ChildMask;
+
+        uint64_t mask = node.ChildMask;
+        uint64_t interior = erode(masks);
+        if (interior != 0)
+        {
+            for (int32_t i = 0; i < 27; ++i)
+            {
+                if (i != 13)
+                {
+                    (&masks[0][0][0])[i] = tileMask(pos + 4 * glm::ivec3(i % 3 - 1, (i / 3) % 3 - 1, i / 9 - 1));
+                }
+            }
+            interior = erode(masks);
+        }
+
+        result.ChildMask = mask & ~interior;
+        result.ChildPtr = newLeafData.size();
+        int32_t slot = 0;
+        for (uint64_t bits = mask; bits != 0; bits &= bits - 1, ++slot)
+        {
+            if (result.ChildMask & bits & -bits)
+            {
+                newLeafData.push_back(leafData[node.ChildPtr + slot]);
+            }
+        }
+        return result;
+    }
+
+    SparseVoxelTreeNode children[64];
+    uint32_t childSources[64];
+    int32_t count = 0;
+    result.ChildMask = 0;
+
+    int32_t childScale = scale - 2;
+    int32_t slot = 0;
+    for (uint64_t bits = node.ChildMask; bits != 0; bits &= bits - 1, ++slot)
+    {
+        int32_t i = std::countr_zero(bits);
+        glm::ivec3 childPos = pos + glm::ivec3((i & 3) << childScale, ((i >> 2) & 3) << childScale, ((i >> 4) & 3) << childScale);
+        const SparseVoxelTreeNode& oldChild = nodePool[node.ChildPtr + slot];
+        SparseVoxelTreeNode child = hollowNode(oldChild, childScale, childPos, newNodePool, newLeafData, sources);
+        if (child.ChildMask != 0)
+        {
+            // The subtree is unchanged if the child kept its mask and all of its children are unchanged
+            bool unchanged = child.ChildMask == oldChild.ChildMask;
+            if (unchanged && sources && !child.IsLeaf && !child.IsSolid)
+            {
+                auto begin = sources->begin() + child.ChildPtr;
+                auto end = begin + popcount64(child.ChildMask);
+                unchanged = std::find(begin, end, UINT32_MAX) == end;
+            }
+            childSources[count] = unchanged ? node.ChildPtr + slot : UINT32_MAX;
+            children[count++] = child;
+            result.ChildMask |= 1ull << i;
+        }
+    }
+
+    result.ChildPtr = newNodePool.size();
+    newNodePool.insert(newNodePool.end(), children, children + count);
+    if (sources)
+    {
+        sources->insert(sources->end(), childSources, childSources + count);
+    }
+    return result;
+}
+
+SparseVoxelTreeNode SparseVoxelTree::deduplicate(const SparseVoxelTreeNode& node, std::vector<SparseVoxelTreeNode>& newNodePool, std::vector<uint8_t>& newLeafData,
+                                                 std::unordered_map<std::string, uint32_t>& leafCache, std::unordered_map<std::string, uint32_t>& nodeCache) const
+{
+    SparseVoxelTreeNode result = node;
+    if (node.IsSolid)
+    {
+        return result;
+    }
+
+    // Key a child array by the mask and the raw bytes of its entries. Children are deduplicated first, so
+    // identical subtrees end up with identical child entries.
+    std::string key(reinterpret_cast<const char*>(&node.ChildMask), sizeof(node.ChildMask));
+
+    if (node.IsLeaf)
+    {
+        const uint8_t* voxels = leafData.data() + node.ChildPtr;
+        key.append(reinterpret_cast<const char*>(voxels), popcount64(node.ChildMask));
+
+        auto [it, inserted] = leafCache.try_emplace(std::move(key), static_cast<uint32_t>(newLeafData.size()));
+        if (inserted)
+        {
+            newLeafData.insert(newLeafData.end(), voxels, voxels + popcount64(node.ChildMask));
+        }
+        result.ChildPtr = it->second;
+        return result;
+    }
+
+    std::vector<SparseVoxelTreeNode> children;
+    children.reserve(popcount64(node.ChildMask));
+    for (int32_t i = 0; i < popcount64(node.ChildMask); ++i)
+    {
+        children.push_back(deduplicate(nodePool[node.ChildPtr + i], newNodePool, newLeafData, leafCache, nodeCache));
+    }
+    key.append(reinterpret_cast<const char*>(children.data()), children.size() * sizeof(SparseVoxelTreeNode));
+
+    auto [it, inserted] = nodeCache.try_emplace(std::move(key), static_cast<uint32_t>(newNodePool.size()));
+    if (inserted)
+    {
+        newNodePool.insert(newNodePool.end(), children.begin(), children.end());
+    }
+    result.ChildPtr = it->second;
+    return result;
+}
+
+void SparseVoxelTree::BuildRankTable()
+{
+    nodeRanks.resize(nodePool.size());
+    for (size_t i = 0; i < nodePool.size(); ++i)
+    {
+        nodeRanks[i] = computeRank(nodePool[i].ChildMask);
+    }
+    rootRank = computeRank(root.ChildMask);
+}
+
+void SparseVoxelTree::BuildLodTable()
+{
+    nodeMaterials.assign(std::max<size_t>(nodePool.size(), 1), 0);
+    nodeVoxelCounts.assign(nodeMaterials.size(), 0);
+    uint64_t count = 0;
+    rootMaterial = buildLod(root, rootScale, count, nullptr);
+}
+
+void SparseVoxelTree::ClearLodTable()
+{
+    nodeMaterials.clear();
+    nodeMaterials.shrink_to_fit();
+    nodeVoxelCounts.clear();
+    nodeVoxelCounts.shrink_to_fit();
+}
+
+// Votes for the node's representative material and stores those of its children. With a dirty region, only the
+// children whose entries it covers are visited; the others keep their stored material and voxel count.
+uint8_t SparseVoxelTree::buildLod(const SparseVoxelTreeNode& node, int32_t scale, uint64_t& count, const SparseVoxelTreeDirtyRegion* dirty)
+{
+    if (node.IsSolid)
+    {
+        count = 1ull << (3 * scale);
+        return node.ChildPtr;
+    }
+
+    // Materials seen among the children and their voxel counts. There are at most 64 distinct ones.
+    uint8_t materials[64];
+    uint64_t weights[64];
+    int32_t distinct = 0;
+
+    auto vote = [&](uint8_t material, uint64_t weight)
+    {
+        for (int32_t i = 0; i < distinct; ++i)
+        {
+            if (materials[i] == material)
+            {
+                weights[i] += weight;
+                return;
+            }
+        }
+        materials[distinct] = material;
+        weights[distinct++] = weight;
+    };
+
+    count = 0;
+    for (int32_t i = 0; i < popcount64(node.ChildMask); ++i)
+    {
+        uint64_t childCount = 1;
+        uint8_t material;
+        uint32_t childPtr = node.ChildPtr + i;
+        if (node.IsLeaf)
+        {
+            material = leafData[childPtr];
+        }
+        else if (dirty && !isDirtyNode(*dirty, childPtr))
+        {
+            material = nodeMaterials[childPtr];
+            childCount = nodeVoxelCounts[childPtr];
+        }
+        else
+        {
+            material = buildLod(nodePool[childPtr], scale - 2, childCount, dirty);
+            nodeMaterials[childPtr] = material;
+            nodeVoxelCounts[childPtr] = childCount;
+        }
+        vote(material, childCount);
+        count += childCount;
+    }
+
+    // Ties go to the material seen first, which is the one closest to the node's origin
+    int32_t best = 0;
+    for (int32_t i = 1; i < distinct; ++i)
+    {
+        if (weights[i] > weights[best])
+        {
+            best = i;
+        }
+    }
+    return distinct != 0 ? materials[best] : 0;
+}
+
+uint8_t SparseVoxelTree::SampleAtLevel(int32_t x, int32_t y, int32_t z, int32_t level) const
+{
+    if (!HasLodTable())
+    {
+        throw std::runtime_error("SampleAtLevel requires the level of detail table, see BuildLodTable");
+    }
+
+    uint32_t extent = 1u << rootScale;
+    if (static_cast<uint32_t>(x) >= extent || static_cast<uint32_t>(y) >= extent || static_cast<uint32_t>(z) >= extent)
+    {
+        return 0;
+    }
+
+    if (level <= 0)
+    {
+        return rootMaterial;
+    }
+
+    const SparseVoxelTreeNode* node = &root;
+    for (int32_t scale = rootScale - 2; ; scale -= 2, --level)
+    {
+        if (node->IsSolid)
+        {
+            return node->ChildPtr;
+        }
+
+        int32_t index = ((x >> scale) & 3) | (((y >> scale) & 3) << 2) | (((z >> scale) & 3) << 4);
+        if (!(node->ChildMask & (1ull << index)))
+        {
+            return 0;
+        }
+
+        int32_t childPtr = node->ChildPtr + childSlot(*node, index);
+        if (node->IsLeaf)
+        {
+            return leafData[childPtr];
+        }
+        if (level == 1)
+        {
+            return nodeMaterials[childPtr];
+        }
+        node = &nodePool[childPtr];
+    }
+}
+
+void SparseVoxelTree::BuildAggregateTable()
+{
+    nodeAggregates.assign(std::max<size_t>(nodePool.size(), 1), {});
+    rootAggregate = buildAggregates(root, rootScale, nullptr);
+}
+
+void SparseVoxelTree::ClearAggregateTable()
+{
+    nodeAggregates.clear();
+    nodeAggregates.shrink_to_fit();
+}
+
+// Aggregates the node and stores the aggregates of its children. With a dirty region, only the children whose
+// entries it covers are visited; the others keep their stored aggregate.
+SparseVoxelTreeAggregate SparseVoxelTree::buildAggregates(const SparseVoxelTreeNode& node, int32_t scale, const SparseVoxelTreeDirtyRegion* dirty)
+{
+    SparseVoxelTreeAggregate aggregate = {};
+    if (node.IsSolid)
+    {
+        uint8_t material = node.ChildPtr;
+        aggregate.VoxelCount = 1ull << (3 * scale);
+        aggregate.MaterialMask[material >> 6] = 1ull << (material & 63);
+        aggregate.MinMaterial = material;
+        aggregate.MaxMaterial = material;
+        return aggregate;
+    }
+
+    aggregate.MinMaterial = 255;
+    for (int32_t i = 0; i < popcount64(node.ChildMask); ++i)
+    {
+        if (node.IsLeaf)
+        {
+            uint8_t material = leafData[node.ChildPtr + i];
+            aggregate.VoxelCount += 1;
+            aggregate.MaterialMask[material >> 6] |= 1ull << (material & 63);
+            aggregate.MinMaterial = std::min(aggregate.MinMaterial, material);
+            aggregate.MaxMaterial = std::max(aggregate.MaxMaterial, material);
+        }
+        else
+        {
+            uint32_t childPtr = node.ChildPtr + i;
+            if (!dirty || isDirtyNode(*dirty, childPtr))
+            {
+                nodeAggregates[childPtr] = buildAggregates(nodePool[childPtr], scale - 2, dirty);
+            }
+            const SparseVoxelTreeAggregate& child = nodeAggregates[childPtr];
+            aggregate.VoxelCount += child.VoxelCount;
+            for (int32_t word = 0; word < 4; ++word)
+            {
+                aggregate.MaterialMask[word] |= child.MaterialMask[word];
+            }
+            aggregate.MinMaterial = std::min(aggregate.MinMaterial, child.MinMaterial);
+            aggregate.MaxMaterial = std::max(aggregate.MaxMaterial, child.MaxMaterial);
+        }
+    }
+
+    if (aggregate.VoxelCount == 0)
+    {
+        aggregate.MinMaterial = 0;
+    }
+    return aggregate;
+}
+
+uint64_t SparseVoxelTree::CountInBox(glm::ivec3 min, glm::ivec3 max) const
+{
+    BoxQuery query = { min, max, -1, false, nullptr, 0 };
+    queryBox(query);
+    return query.count;
+}
+
+uint64_t SparseVoxelTree::CountInBox(glm::ivec3 min, glm::ivec3 max, uint8_t material) const
+{
+    if (material == 0)
+    {
+        return 0;
+    }
+
+    BoxQuery query = { min, max, material, false, nullptr, 0 };
+    queryBox(query);
+    return query.count;
+}
+
+bool SparseVoxelTree::AnyInBox(glm::ivec3 min, glm::ivec3 max) const
+{
+    BoxQuery query = { min, max, -1, true, nullptr, 0 };
+    queryBox(query);
+    return query.count != 0;
+}
+
+bool SparseVoxelTree::AnyInBox(glm::ivec3 min, glm::ivec3 max, uint8_t material) const
+{
+    if (material == 0)
+    {
+        return false;
+    }
+
+    BoxQuery query = { min, max, material, true, nullptr, 0 };
+    queryBox(query);
+    return query.count != 0;
+}
+
+std::array<uint64_t, 256> SparseVoxelTree::MaterialHistogram(glm::ivec3 min, glm::ivec3 max) const
+{
+    std::array<uint64_t, 256> histogram = {};
+    BoxQuery query = { min, max, -1, false, histogram.data(), 0 };
+    queryBox(query);
+    return histogram;
+}
+
+void SparseVoxelTree::queryBox(BoxQuery& query) const
+{
+    // Clip the box to the root region
+    int32_t extent = 1 << rootScale;
+    query.min = glm::clamp(query.min, glm::ivec3(0), glm::ivec3(extent));
+    query.max = glm::clamp(query.max, glm::ivec3(0), glm::ivec3(extent));
+    if (glm::any(glm::greaterThanEqual(query.min, query.max)) || root.ChildMask == 0)
+    {
+        return;
+    }
+
+    queryBox(root, HasAggregateTable() ? &rootAggregate : nullptr, rootScale, glm::ivec3(0), query);
+}
+
+void SparseVoxelTree::queryBox(const SparseVoxelTreeNode& node, const SparseVoxelTreeAggregate* aggregate, int32_t scale, glm::ivec3 pos,
+                               BoxQuery& query) const
+{
+    if (query.stopAtFirst && query.count != 0)
+    {
+        return;
+    }
+
+    auto add = [&](uint8_t material, uint64_t count)
+    {
+        if (query.material >= 0 && material != query.material)
+        {
+            return;
+        }
+        query.count += count;
+        if (query.histogram)
+        {
+            query.histogram[material] += count;
+        }
+    };
+
+    if (aggregate && query.material >= 0 && !(aggregate->MaterialMask[query.material >> 6] & (1ull << (query.material & 63))))
+    {
+        return;
+    }
+
+    glm::ivec3 end = pos + (1 << scale);
+    glm::ivec3 overlapMin = glm::max(pos, query.min);
+    glm::ivec3 overlapMax = glm::min(end, query.max);
+    bool inside = overlapMin == pos && overlapMax == end;
+
+    if (node.IsSolid)
+    {
+        glm::u64vec3 overlap(overlapMax - overlapMin);
+        add(static_cast<uint8_t>(node.ChildPtr), overlap.x * overlap.y * overlap.z);
+        return;
+    }
+
+    // Nodes only exist if they hold voxels, so a contained node answers AnyInBox without an aggregate
+    if (inside && query.material < 0 && !query.histogram)
+    {
+        query.count += aggregate ? aggregate->VoxelCount : query.stopAtFirst ? 1 : countVoxels(node, scale);
+        return;
+    }
+    if (inside && aggregate && aggregate->MinMaterial == aggregate->MaxMaterial)
+    {
+        add(aggregate->MinMaterial, aggregate->VoxelCount);
+        return;
+    }
+
+    // Mask of the cells overlapping the box, built from the overlapping cell range along each axis
+    int32_t childScale = scale - 2;
+    glm::ivec3 cellMin = (overlapMin - pos) >> childScale;
+    glm::ivec3 cellMax = ((overlapMax - pos - 1) >> childScale) + 1;
+    uint64_t xBits = (0xFull >> (4 - (cellMax.x - cellMin.x))) << cellMin.x;
+    uint64_t yBits = (0xFFFFull >> (16 - 4 * (cellMax.y - cellMin.y))) << (4 * cellMin.y);
+    uint64_t zBits = (~0ull >> (64 - 16 * (cellMax.z - cellMin.z))) << (16 * cellMin.z);
+    uint64_t cells = node.ChildMask & (xBits * 0x1111111111111111ull) & (yBits * 0x0001000100010001ull) & zBits;
+
+    if (node.IsLeaf && query.material < 0 && !query.histogram)
+    {
+        query.count += popcount64(cells);
+        return;
+    }
+
+    for (; cells != 0; cells &= cells - 1)
+    {
+        int32_t i = std::countr_zero(cells);
+        int32_t slot = popcount64(node.ChildMask & ((1ull << i) - 1));
+        if (node.IsLeaf)
+        {
+            add(leafData[node.ChildPtr + slot], 1);
+            continue;
+        }
+
+        glm::ivec3 childPos = pos + glm::ivec3((i & 3) << childScale, ((i >> 2) & 3) << childScale, ((i >> 4) & 3) << childScale);
+        queryBox(nodePool[node.ChildPtr + slot], aggregate ? &nodeAggregates[node.ChildPtr + slot] : nullptr, childScale, childPos, query);
+        if (query.stopAtFirst && query.count != 0)
+        {
+            return;
+        }
+    }
+}
+
+void SparseVoxelTree::ClearRankTable()
+{
+    nodeRanks.clear();
+    nodeRanks.shrink_to_fit();
+}
+
+// Function to count the total number of voxels in the tree
+size_t SparseVoxelTree::GetTotalVoxels() const
+{
+    // leafData is shared between identical leaves when deduplicating, so count voxels at build time
+    return voxelCount;
+}
+
+// Function to get the voxel data at a specific coordinate
+uint8_t SparseVoxelTree::At(int32_t x, int32_t y, int32_t z) const
+{
+    // Coordinates outside of the root region are always empty
+    uint32_t extent = 1u << rootScale;
+    if (static_cast<uint32_t>(x) >= extent || static_cast<uint32_t>(y) >= extent || static_cast<uint32_t>(z) >= extent)
+    {
+        return 0;
+    }
+
+    // Every path from the root to a leaf has the same depth, so the cell index at each level
+    // comes straight from the coordinate bits at that level's scale.
+    const SparseVoxelTreeNode* node = &root;
+    for (int32_t scale = rootScale - 2; ; scale -= 2)
+    {
+        if (node->IsSolid)
+        {
+            return node->ChildPtr;
+        }
+
+        int32_t index = ((x >> scale) & 3) | (((y >> scale) & 3) << 2) | (((z >> scale) & 3) << 4);
+        if (!(node->ChildMask & (1ull << index)))
+        {
+            return 0;
+        }
+
+        int32_t childPtr = node->ChildPtr + childSlot(*node, index);
+        if (node->IsLeaf)
+        {
+            return leafData[childPtr];
+        }
+        node = &nodePool[childPtr];
+    }
+}
+
+void SparseVoxelTree::At(std::span<const glm::ivec3> positions, std::span<uint8_t> results) const
+{
+    assert(results.size() >= positions.size());
+
+    // The path of a lookup is encoded as the 6-bit cell indices of every level, root first, which only
+    // fits in 64 bits for trees up to 2^21 voxels per axis.
+    if (rootScale > 21)
+    {
+        for (size_t i = 0; i < positions.size(); ++i)
+        {
+            results[i] = At(positions[i].x, positions[i].y, positions[i].z);
+        }
+        return;
+    }
+
+    // Sorting by path visits the lookups in Morton order, so consecutive lookups share most of their path
+    struct Lookup
+    {
+        uint64_t path;
+        uint32_t resultIndex;
+    };
+
+    std::vector<Lookup> order;
+    order.reserve(positions.size());
+
+    uint32_t extent = 1u << rootScale;
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        const glm::ivec3& p = positions[i];
+        if (static_cast<uint32_t>(p.x) >= extent || static_cast<uint32_t>(p.y) >= extent || static_cast<uint32_t>(p.z) >= extent)
+        {
+            results[i] = 0;
+            continue;
+        }
+
+        order.push_back({ cellPath(p.x, p.y, p.z, rootScale), static_cast<uint32_t>(i) });
+    }
+
+    radixSortByPath(order, 3 * rootScale);
+
+    // Walk a group of lookups down the tree together, one level at a time. The node loads of
+    // the lookups in a group are independent, so their memory latency overlaps.
+    constexpr size_t GroupSize = 8;
+
+    for (size_t base = 0; base < order.size(); base += GroupSize)
+    {
+        size_t count = std::min(GroupSize, order.size() - base);
+
+        const SparseVoxelTreeNode* nodes[GroupSize];
+        uint32_t active = (1u << count) - 1;
+        std::fill(nodes, nodes + count, &root);
+
+        for (int32_t scale = rootScale - 2; active != 0; scale -= 2)
+        {
+            for (uint32_t pending = active; pending != 0; pending &= pending - 1)
+            {
+                uint32_t lane = std::countr_zero(pending);
+                const Lookup& lookup = order[base + lane];
+                const SparseVoxelTreeNode* node = nodes[lane];
+
+                if (node->IsSolid)
+                {
+                    results[lookup.resultIndex] = node->ChildPtr;
+                    active &= ~(1u << lane);
+                    continue;
+                }
+
+                int32_t index = (lookup.path >> (3 * scale)) & 63;
+                if (!(node->ChildMask & (1ull << index)))
+                {
+                    results[lookup.resultIndex] = 0;
+                    active &= ~(1u << lane);
+                    continue;
+                }
+
+                int32_t childPtr = node->ChildPtr + childSlot(*node, index);
+                if (node->IsLeaf)
+                {
+                    results[lookup.resultIndex] = leafData[childPtr];
+                    active &= ~(1u << lane);
+                    continue;
+                }
+
+                nodes[lane] = &nodePool[childPtr];
+                __builtin_prefetch(nodes[lane]);
+            }
+        }
+    }
+}
+
+SparseVoxelRayHit SparseVoxelTree::Raycast(const SparseVoxelRay& ray, float maxDistance, SparseVoxelRayMode mode) const
+{
+    return mode == SparseVoxelRayMode::AnyHit ? raycast<true>(ray, maxDistance) : raycast<false>(ray, maxDistance);
+}
+
+namespace
+{
+    // Node access for TraverseHierarchicalDda. With AnyHit the material lookup and normal tracking are skipped.
+    template<bool AnyHit>
+    struct RaycastSource
+    {
+        using Node = const SparseVoxelTreeNode*;
+        using Value = uint8_t;
+        static constexpr int32_t MaxDepth = SparseVoxelTree::MaxRootScale / 2;
+        static constexpr bool MonotonicSteps = true;
+        static constexpr bool TrackNormals = !AnyHit;
+
+        const SparseVoxelTreeNode* root;
+        const SparseVoxelTreeNode* nodePool;
+        const uint8_t* leafData;
+
+        Node Root() const { return root; }
+        void BeginStep(float) {}
+
+        HierarchicalDdaStep Visit(Node node, int32_t, glm::ivec3 pos, int32_t& shift, Node& child, uint8_t& material) const
+        {
+            if (node->IsSolid)
+            {
+                material = static_cast<uint8_t>(node->ChildPtr);
+                return HierarchicalDdaStep::Hit;
+            }
+
+            int32_t index = ((pos.x >> shift) & 3) | (((pos.y >> shift) & 3) << 2) | (((pos.z >> shift) & 3) << 4);
+            uint64_t bit = 1ull << index;
+            if (!(node->ChildMask & bit))
+            {
+                return HierarchicalDdaStep::Empty;
+            }
+
+            uint32_t slot = node->ChildPtr + std::popcount(node->ChildMask & (bit - 1));
+            if (node->IsLeaf)
+            {
+                if constexpr (!AnyHit)
+                {
+                    material = leafData[slot];
+                }
+                return HierarchicalDdaStep::Hit;
+            }
+
+            child = &nodePool[slot];
+            return HierarchicalDdaStep::Descend;
+        }
+    };
+}
+
+template<bool AnyHit>
+SparseVoxelRayHit SparseVoxelTree::raycast(const SparseVoxelRay& ray, float maxDistance) const
+{
+    SparseVoxelRayHit hit;
+    HierarchicalDdaRay ddaRay;
+    if (!ClipRayToRoot(ray.Origin, ray.Direction, rootScale, maxDistance, ddaRay))
+    {
+        return hit;
+    }
+
+    RaycastSource<AnyHit> source{ &root, nodePool.data(), leafData.data() };
+    HierarchicalDdaHit<uint8_t> ddaHit = TraverseHierarchicalDda(source, ddaRay, rootScale);
+    if (ddaHit.Hit)
+    {
+        hit.Hit = true;
+        hit.Distance = ddaHit.Distance;
+        hit.Voxel = ddaHit.Voxel;
+        if constexpr (!AnyHit)
+        {
+            hit.Normal = ddaHit.Normal;
+            hit.Material = ddaHit.Material;
+        }
+    }
+    return hit;
+}
+
+void SparseVoxelTree::RaycastBatch(std::span<const SparseVoxelRay> rays, std::span<SparseVoxelRayHit> hits, float maxDistance,
+                                   SparseVoxelRayMode mode, WorkStealingPool* pool) const
+{
+    assert(hits.size() >= rays.size());
+
+    // Rays with the same direction signs and nearby origins are sorted next to each other. The key is the
+    // octant above the cell path of the origin, clamped to the root region, over at most 4 levels of cells.
+    // The ray's index sits above the key, so each entry is a single word.
+    struct QueuedRay
+    {
+        uint64_t path;
+    };
+
+    int32_t keyScale = std::min(rootScale, 8);
+    int32_t keyShift = rootScale - keyScale;
+    float maxCoord = static_cast<float>((1 << rootScale) - 1);
+
+    std::vector<QueuedRay> order(rays.size());
+    for (size_t i = 0; i < rays.size(); ++i)
+    {
+        const SparseVoxelRay& ray = rays[i];
+        glm::ivec3 origin = glm::ivec3(glm::clamp(ray.Origin, glm::vec3(0.0f), glm::vec3(maxCoord))) >> keyShift;
+        uint64_t octant = (ray.Direction.x < 0.0f) | ((ray.Direction.y < 0.0f) << 1) | ((ray.Direction.z < 0.0f) << 2);
+        order[i].path = static_cast<uint64_t>(i) << 32 | octant << (3 * keyScale) | cellPath(origin.x, origin.y, origin.z, keyScale);
+    }
+
+    radixSortByPath(order, 3 * keyScale + 3);
+
+    // Runs are long enough to amortize claiming them, and short enough to balance over the threads
+    constexpr uint32_t RunSize = 256;
+    uint32_t runCount = static_cast<uint32_t>((order.size() + RunSize - 1) / RunSize);
+
+    // Each run is gathered into and scattered from local arrays in separate loops, so the scattered loads
+    // and stores overlap instead of stalling the traversal
+    auto castRun = [&](uint32_t run, uint32_t)
+    {
+        size_t begin = static_cast<size_t>(run) * RunSize;
+        uint32_t count = static_cast<uint32_t>(std::min<size_t>(RunSize, order.size() - begin));
+
+        SparseVoxelRay runRays[RunSize];
+        SparseVoxelRayHit runHits[RunSize];
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            runRays[i] = rays[order[begin + i].path >> 32];
+        }
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            runHits[i] = mode == SparseVoxelRayMode::AnyHit ? raycast<true>(runRays[i], maxDistance) : raycast<false>(runRays[i], maxDistance);
+        }
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            hits[order[begin + i].path >> 32] = runHits[i];
+        }
+    };
+
+    if (pool != nullptr && runCount > 1)
+    {
+        pool->ParallelFor(runCount, castRun);
+    }
+    else
+    {
+        for (uint32_t run = 0; run < runCount; ++run)
+        {
+            castRun(run, 0);
+        }
+    }
+}
+
+VoxelMap SparseVoxelTree::ToVoxelMap() const
+{
+    VoxelMap voxelMap;
+    voxelMap.size_x = dimensions.x;
+    voxelMap.size_y = dimensions.y;
+    voxelMap.size_z = dimensions.z;
+    voxelMap.voxels.resize(static_cast<size_t>(voxelMap.size_x) * voxelMap.size_y * voxelMap.size_z, 0);
+
+    DispatchRootScale([&](auto scale) { fillVoxelMap<scale>(voxelMap, root, glm::ivec3(0, 0, 0)); });
+    return voxelMap;
+}
+
+void SparseVoxelTree::PrintTree() const
+{
+    printTree(root, rootScale, glm::ivec3(0, 0, 0), 0);
+}
+
+void SparseVoxelTree::OccupancyPyramid::Build(const VoxelMap& voxelMap, int32_t rootScale)
+{
+    // One level per scale below the root: level 0 holds the leaves (scale 2), the last level the root's children
+    int32_t levelCount = std::max(rootScale / 2 - 1, 1);
+    levels.assign(levelCount, {});
+    sizes.assign(levelCount, glm::uvec3(0));
+    voxelCount = 0;
+
+    glm::uvec3 size = glm::uvec3(voxelMap.size_x, voxelMap.size_y, voxelMap.size_z);
+    for (int32_t level = 0; level < levelCount; ++level)
+    {
+        size = (size + 3u) / 4u;
+        sizes[level] = size;
+        levels[level].assign((static_cast<size_t>(size.x) * size.y * size.z + 63) / 64, 0);
+    }
+
+    // Mark the occupied leaves while counting the non-empty voxels
+    const uint8_t* voxel = voxelMap.voxels.data();
+    for (uint32_t z = 0; z < voxelMap.size_z; ++z)
+    {
+        for (uint32_t y = 0; y < voxelMap.size_y; ++y)
+        {
+            size_t rowIndex = (y >> 2) * static_cast<size_t>(sizes[0].x) + (z >> 2) * static_cast<size_t>(sizes[0].x) * sizes[0].y;
+            for (uint32_t x = 0; x < voxelMap.size_x; ++x, ++voxel)
+            {
+                if (*voxel != 0)
+                {
+                    size_t index = rowIndex + (x >> 2);
+                    levels[0][index >> 6] |= 1ull << (index & 63);
+                    ++voxelCount;
+                }
+            }
+        }
+    }
+
+    // Every occupied cell marks its parent on the next level
+    for (int32_t level = 1; level < levelCount; ++level)
+    {
+        const glm::uvec3& childSize = sizes[level - 1];
+        const glm::uvec3& parentSize = sizes[level];
+
+        for (size_t word = 0; word < levels[level - 1].size(); ++word)
+        {
+            for (uint64_t bits = levels[level - 1][word]; bits != 0; bits &= bits - 1)
+            {
+                size_t index = (word << 6) + std::countr_zero(bits);
+                uint32_t x = index % childSize.x;
+                uint32_t y = (index / childSize.x) % childSize.y;
+                uint32_t z = index / (static_cast<size_t>(childSize.x) * childSize.y);
+
+                size_t parentIndex = (x >> 2) + (y >> 2) * static_cast<size_t>(parentSize.x) + (z >> 2) * static_cast<size_t>(parentSize.x) * parentSize.y;
+                levels[level][parentIndex >> 6] |= 1ull << (parentIndex & 63);
+            }
+        }
+    }
+}
+
+bool SparseVoxelTree::OccupancyPyramid::IsOccupied(int32_t level, glm::ivec3 pos) const
+{
+    glm::uvec3 cell = glm::uvec3(pos) >> static_cast<uint32_t>(2 * level + 2);
+    const glm::uvec3& size = sizes[level];
+    if (cell.x >= size.x || cell.y >= size.y || cell.z >= size.z)
+    {
+        return false;
+    }
+
+    size_t index = cell.x + cell.y * static_cast<size_t>(size.x) + cell.z * static_cast<size_t>(size.x) * size.y;
+    return (levels[level][index >> 6] >> (index & 63)) & 1;
+}
+
+size_t SparseVoxelTree::OccupancyPyramid::CountNodes() const
+{
+    size_t count = 0;
+    for (const auto& level : levels)
+    {
+        for (uint64_t bits : level)
+        {
+            count += popcount64(bits);
+        }
+    }
+    return count;
+}
+
+SparseVoxelTreeNode SparseVoxelTree::generateLeaf(const VoxelMap& voxelMap, glm::ivec3 pos, std::vector<uint8_t>& leafData) const
+{
+    assert((pos.x | pos.y | pos.z) % 4 == 0);
+
+    SparseVoxelTreeNode node = {};
+
+    // Repack voxels into 4x4x4 tile
+    alignas(64) uint8_t temp[64] = { 0 };
+
+    for (int32_t i = 0; i < 64; ++i)
+    {
+        int32_t x = pos.x + (i & 3);
+        int32_t y = pos.y + ((i >> 2) & 3);
+        int32_t z = pos.z + ((i >> 4) & 3);
+
+        if (static_cast<uint32_t>(x) < voxelMap.size_x &&
+            static_cast<uint32_t>(y) < voxelMap.size_y &&
+            static_cast<uint32_t>(z) < voxelMap.size_z)
+        {
+            size_t index = x + y * static_cast<size_t>(voxelMap.size_x) + z * static_cast<size_t>(voxelMap.size_x) * voxelMap.size_y;
+            temp[i] = voxelMap.voxels[index];
+        }
+    }
+
+    node.IsLeaf = 1;
+    node.ChildMask = PackBits64(temp); // Generate bitmask of `temp[i] != 0`.
+
+    LeftPack(temp, node.ChildMask); // "Remove" entries where respective mask bit is zero.
+    node.ChildPtr = leafData.size();
+    leafData.insert(leafData.end(), temp, temp + popcount64(node.ChildMask));
+    collapseLeaf(node, leafData);
+
+    return node;
+}
+
+struct SparseVoxelTree::BuildSource
+{
+    using Node = SparseVoxelTreeNode;
+    static constexpr int32_t LeafScale = 2;
+    static constexpr int32_t MaxDepth = (MaxRootScale - LeafScale) / 2;
+
+    const SparseVoxelTree& tree;
+    const VoxelMap& voxelMap;
+    const OccupancyPyramid& occupancy;
+    std::vector<uint8_t>& leafData;
+
+    bool IsOccupied(int32_t level, glm::ivec3 pos) const { return occupancy.IsOccupied(level, pos); }
+    SparseVoxelTreeNode GenerateLeaf(glm::ivec3 pos) const { return tree.generateLeaf(voxelMap, pos, leafData); }
+    bool CollapseChildren(SparseVoxelTreeNode& node, const SparseVoxelTreeNode* children) const { return tree.collapseChildren(node, children); }
+};
+
+SparseVoxelTreeNode SparseVoxelTree::generateTree(const VoxelMap& voxelMap, const OccupancyPyramid& occupancy, int32_t scale, glm::ivec3 pos,
+                                                  std::vector<SparseVoxelTreeNode>& nodePool, std::vector<uint8_t>& leafData) const
+{
+    BuildSource source{ *this, voxelMap, occupancy, leafData };
+    return BuildSparseTree(source, scale, pos, nodePool);
+}
+
+SparseVoxelTreeDirtyRegion SparseVoxelTree::SetVoxel(int32_t x, int32_t y, int32_t z, uint8_t material)
+{
+    SparseVoxel edit = { static_cast<uint32_t>(x), static_cast<uint32_t>(y), static_cast<uint32_t>(z), material };
+    return ApplyEdits(std::span<const SparseVoxel>(&edit, 1));
+}
+
+SparseVoxelTreeDirtyRegion SparseVoxelTree::FillBox(glm::ivec3 min, glm::ivec3 max, uint8_t material)
+{
+    SparseVoxelTreeDirtyRegion dirty;
+
+    // Clip the box to the root region
+    int32_t extent = 1 << rootScale;
+    min = glm::clamp(min, glm::ivec3(0), glm::ivec3(extent));
+    max = glm::clamp(max, glm::ivec3(0), glm::ivec3(extent));
+    if (glm::any(glm::greaterThanEqual(min, max)))
+    {
+        return dirty;
+    }
+
+    // Edit each overlapped 4x4x4 tile once
+    TileEdit edit;
+    std::fill(edit.values, edit.values + 64, material);
+    edit.hasFills = material != 0;
+
+    glm::ivec3 tileMin = min & ~3;
+    for (int32_t tz = tileMin.z; tz < max.z; tz += 4)
+    {
+        for (int32_t ty = tileMin.y; ty < max.y; ty += 4)
+        {
+            for (int32_t tx = tileMin.x; tx < max.x; tx += 4)
+            {
+                edit.writeMask = 0;
+                for (int32_t i = 0; i < 64; ++i)
+                {
+                    glm::ivec3 pos = glm::ivec3(tx + (i & 3), ty + ((i >> 2) & 3), tz + ((i >> 4) & 3));
+                    if (glm::all(glm::greaterThanEqual(pos, min)) && glm::all(glm::lessThan(pos, max)))
+                    {
+                        edit.writeMask |= 1ull << i;
+                    }
+                }
+
+                if (editTile(root, rootScale, glm::ivec3(tx, ty, tz), edit, dirty))
+                {
+                    dirty.RootChanged = true;
+                }
+            }
+        }
+    }
+
+    finishEdit(dirty);
+    return dirty;
+}
+
+SparseVoxelTreeDirtyRegion SparseVoxelTree::EraseBox(glm::ivec3 min, glm::ivec3 max)
+{
+    return FillBox(min, max, 0);
+}
+
+SparseVoxelTreeDirtyRegion SparseVoxelTree::ApplyEdits(std::span<const SparseVoxel> edits)
+{
+    SparseVoxelTreeDirtyRegion dirty;
+
+    struct Entry
+    {
+        uint64_t path;
+        uint32_t editIndex;
+    };
+
+    // Group the edits by tile. Trees small enough for a 64-bit path are sorted into Morton order first, so every
+    // tile is edited once and consecutive tiles share most of their path; the sort is stable, so later edits to
+    // the same voxel win.
+    uint32_t extent = 1u << rootScale;
+    std::vector<Entry> entries;
+    entries.reserve(edits.size());
+    for (size_t i = 0; i < edits.size(); ++i)
+    {
+        const SparseVoxel& edit = edits[i];
+        if (edit.x < extent && edit.y < extent && edit.z < extent)
+        {
+            uint64_t path = rootScale <= 21 ? cellPath(edit.x, edit.y, edit.z, rootScale) : 0;
+            entries.push_back({ path, static_cast<uint32_t>(i) });
+        }
+    }
+    if (rootScale <= 21)
+    {
+        radixSortByPath(entries, 3 * rootScale);
+    }
+
+    auto tileOf = [&](const Entry& entry)
+    {
+        const SparseVoxel& edit = edits[entry.editIndex];
+        return glm::ivec3(edit.x & ~3u, edit.y & ~3u, edit.z & ~3u);
+    };
+
+    for (size_t begin = 0; begin < entries.size(); )
+    {
+        glm::ivec3 tile = tileOf(entries[begin]);
+
+        TileEdit edit;
+        edit.writeMask = 0;
+        edit.hasFills = false;
+
+        size_t end = begin;
+        for (; end < entries.size() && tileOf(entries[end]) == tile; ++end)
+        {
+            const SparseVoxel& voxel = edits[entries[end].editIndex];
+            int32_t index = (voxel.x & 3) | ((voxel.y & 3) << 2) | ((voxel.z & 3) << 4);
+            edit.writeMask |= 1ull << index;
+            edit.values[index] = voxel.material;
+            edit.hasFills |= voxel.material != 0;
+        }
+
+        if (editTile(root, rootScale, tile, edit, dirty))
+        {
+            dirty.RootChanged = true;
+        }
+        begin = end;
+    }
+
+    finishEdit(dirty);
+    return dirty;
+}
+
+bool SparseVoxelTree::editTile(SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 tilePos, const TileEdit& edit, SparseVoxelTreeDirtyRegion& dirty)
+{
+    // Trees with shared subtrees are edited copy-on-write: modified arrays are copied, since other nodes may
+    // still point at the old ones. `node` holds one reference to its array, which moves to the new array.
+    bool copyOnWrite = sharesArrays;
+
+    if (node.IsLeaf)
+    {
+        // Unpack the tile, apply the edit and pack it again. Solid leaves have no voxels in leafData.
+        alignas(64) uint8_t tile[64] = { 0 };
+        uint32_t oldPtr = node.ChildPtr;
+        uint32_t count = node.IsSolid ? 0 : popcount64(node.ChildMask);
+        if (node.IsSolid)
+        {
+            std::fill(tile, tile + 64, static_cast<uint8_t>(node.ChildPtr));
+        }
+        uint32_t slot = 0;
+        for (uint64_t bits = count != 0 ? node.ChildMask : 0; bits != 0; bits &= bits - 1)
+        {
+            tile[std::countr_zero(bits)] = leafData[oldPtr + slot++];
+        }
+        for (uint64_t bits = edit.writeMask; bits != 0; bits &= bits - 1)
+        {
+            tile[std::countr_zero(bits)] = edit.values[std::countr_zero(bits)];
+        }
+
+        uint64_t mask = PackBits64(tile);
+        uint32_t oldVoxels = popcount64(node.ChildMask);
+
+        if (options.CollapseSolid && mask == ~0ull && std::all_of(tile, tile + 64, [&](uint8_t voxel) { return voxel == tile[0]; }))
+        {
+            if (node.IsSolid && node.ChildPtr == tile[0])
+            {
+                return false;
+            }
+            dropReference(node);
+            node = makeSolid(2, tile[0]);
+            voxelCount = voxelCount + 64 - oldVoxels;
+            return true;
+        }
+
+        LeftPack(tile, mask);
+        uint32_t newCount = popcount64(mask);
+
+        if (!node.IsSolid && mask == node.ChildMask)
+        {
+            if (std::equal(tile, tile + count, leafData.begin() + oldPtr))
+            {
+                return false;
+            }
+            if (!copyOnWrite)
+            {
+                std::copy(tile, tile + count, leafData.begin() + oldPtr);
+                dirty.LeafDataRanges.push_back({ oldPtr, oldPtr + count });
+                return false;
+            }
+        }
+
+        SparseVoxelTreeNode oldNode = node;
+        node.IsSolid = 0;
+        node.ChildMask = mask;
+        node.ChildPtr = allocateLeafData(newCount);
+        std::copy(tile, tile + newCount, leafData.begin() + node.ChildPtr);
+        shareArray(node);
+        uint32_t ptr = node.ChildPtr;
+        dirty.LeafDataRanges.push_back({ ptr, ptr + newCount });
+        dropReference(oldNode);
+
+        voxelCount = voxelCount + newCount - oldVoxels;
+        return true;
+    }
+
+    scale -= 2;
+
+    // Split a solid node into 64 solid children, unless the edit only writes its own material
+    bool split = false;
+    if (node.IsSolid)
+    {
+        bool unchanged = true;
+        for (uint64_t bits = edit.writeMask; bits != 0 && unchanged; bits &= bits - 1)
+        {
+            unchanged = edit.values[std::countr_zero(bits)] == node.ChildPtr;
+        }
+        if (unchanged)
+        {
+            return false;
+        }
+
+        uint32_t ptr = allocateNodes(64);
+        std::fill(nodePool.begin() + ptr, nodePool.begin() + ptr + 64, makeSolid(scale, node.ChildPtr));
+
+        node.IsSolid = 0;
+        node.ChildPtr = ptr;
+        shareArray(node);
+        ptr = node.ChildPtr;
+        dirty.NodeRanges.push_back({ ptr, ptr + 64 });
+        split = true;
+    }
+
+    int32_t index = ((tilePos.x >> scale) & 3) | (((tilePos.y >> scale) & 3) << 2) | (((tilePos.z >> scale) & 3) << 4);
+    uint64_t bit = 1ull << index;
+    bool exists = (node.ChildMask & bit) != 0;
+
+    // Erasing inside an empty region changes nothing
+    if (!exists && !edit.hasFills)
+    {
+        return split;
+    }
+
+    uint32_t count = popcount64(node.ChildMask);
+    uint32_t slot = popcount64(node.ChildMask & (bit - 1));
+
+    SparseVoxelTreeNode child = {};
+    if (exists)
+    {
+        child = nodePool[node.ChildPtr + slot];
+    }
+    else
+    {
+        child.IsLeaf = scale == 2;
+    }
+
+    // The copy of the entry takes its own reference, which the child's edit moves to its new array
+    if (copyOnWrite)
+    {
+        addReference(child);
+    }
+
+    size_t dirtyCount = dirty.NodeRanges.size() + dirty.LeafDataRanges.size();
+    if (!editTile(child, scale, tilePos, edit, dirty))
+    {
+        if (copyOnWrite)
+        {
+            dropReference(child);
+        }
+
+        // The child's subtree may still have been written in place. Its entry is marked so the level of
+        // detail table is updated along the path down to the edit, see updateTables.
+        if (exists && (HasLodTable() || HasAggregateTable()) && dirty.NodeRanges.size() + dirty.LeafDataRanges.size() != dirtyCount)
+        {
+            dirty.NodeRanges.push_back({ node.ChildPtr + slot, node.ChildPtr + slot + 1 });
+        }
+        return split;
+    }
+
+    // The child was only updated: overwrite its entry
+    if (exists && child.ChildMask != 0 && !copyOnWrite)
+    {
+        nodePool[node.ChildPtr + slot] = child;
+        dirty.NodeRanges.push_back({ node.ChildPtr + slot, node.ChildPtr + slot + 1 });
+        return collapseEdited(node) || split;
+    }
+
+    // Otherwise move the children to an array of the new size, inserting, replacing or removing the child
+    if (!exists && child.ChildMask == 0)
+    {
+        return split;
+    }
+
+    uint32_t newCount = exists ? (child.ChildMask != 0 ? count : count - 1) : count + 1;
+    uint32_t ptr = allocateNodes(newCount);
+
+    std::copy(nodePool.begin() + node.ChildPtr, nodePool.begin() + node.ChildPtr + slot, nodePool.begin() + ptr);
+    uint32_t write = ptr + slot;
+    if (child.ChildMask != 0)
+    {
+        nodePool[write++] = child;
+    }
+    uint32_t rest = node.ChildPtr + slot + (exists ? 1 : 0);
+    std::copy(nodePool.begin() + rest, nodePool.begin() + node.ChildPtr + count, nodePool.begin() + write);
+
+    // The siblings are now referenced by both arrays until the old one is dropped
+    SparseVoxelTreeNode oldNode = node;
+    node.ChildMask = child.ChildMask != 0 ? (node.ChildMask | bit) : (node.ChildMask & ~bit);
+    node.ChildPtr = ptr;
+    if (copyOnWrite)
+    {
+        for (uint32_t i = ptr; i < ptr + newCount; ++i)
+        {
+            if (i != ptr + slot || child.ChildMask == 0)
+            {
+                addReference(nodePool[i]);
+            }
+        }
+        shareArray(node);
+        ptr = node.ChildPtr;
+    }
+    dirty.NodeRanges.push_back({ ptr, ptr + newCount });
+    dropReference(oldNode);
+
+    collapseEdited(node);
+    return true;
+}
+
+bool SparseVoxelTree::collapseEdited(SparseVoxelTreeNode& node)
+{
+    // Turn the node back into a solid one once all of its children are solid with the same material, dropping
+    // its reference to the array
+    SparseVoxelTreeNode oldNode = node;
+    if (!collapseChildren(node, nodePool.data() + node.ChildPtr))
+    {
+        return false;
+    }
+
+    dropReference(oldNode);
+    return true;
+}
+
+uint32_t SparseVoxelTree::allocateNodes(uint32_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    std::vector<uint32_t>& freeBlocks = freeNodeBlocks[count];
+    if (!freeBlocks.empty())
+    {
+        uint32_t ptr = freeBlocks.back();
+        freeBlocks.pop_back();
+        return ptr;
+    }
+
+    uint32_t ptr = nodePool.size();
+    nodePool.resize(ptr + count);
+    return ptr;
+}
+
+void SparseVoxelTree::releaseNodes(uint32_t ptr, uint32_t count)
+{
+    if (count != 0)
+    {
+        freeNodeBlocks[count].push_back(ptr);
+    }
+}
+
+uint32_t SparseVoxelTree::allocateLeafData(uint32_t count)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    std::vector<uint32_t>& freeBlocks = freeLeafDataBlocks[count];
+    if (!freeBlocks.empty())
+    {
+        uint32_t ptr = freeBlocks.back();
+        freeBlocks.pop_back();
+        return ptr;
+    }
+
+    uint32_t ptr = leafData.size();
+    leafData.resize(ptr + count);
+    return ptr;
+}
+
+void SparseVoxelTree::releaseLeafData(uint32_t ptr, uint32_t count)
+{
+    if (count != 0)
+    {
+        freeLeafDataBlocks[count].push_back(ptr);
+    }
+}
+
+void SparseVoxelTree::finishEdit(SparseVoxelTreeDirtyRegion& dirty)
+{
+    // Merge overlapping and adjacent ranges
+    auto merge = [](std::vector<std::pair<uint32_t, uint32_t>>& ranges)
+    {
+        std::sort(ranges.begin(), ranges.end());
+        size_t count = 0;
+        for (const auto& range : ranges)
+        {
+            if (count != 0 && range.first <= ranges[count - 1].second)
+            {
+                ranges[count - 1].second = std::max(ranges[count - 1].second, range.second);
+            }
+            else
+            {
+                ranges[count++] = range;
+            }
+        }
+        ranges.resize(count);
+    };
+    merge(dirty.NodeRanges);
+    merge(dirty.LeafDataRanges);
+
+    if (HasRankTable())
+    {
+        nodeRanks.resize(nodePool.size());
+        for (const auto& range : dirty.NodeRanges)
+        {
+            for (uint32_t i = range.first; i < range.second; ++i)
+            {
+                nodeRanks[i] = computeRank(nodePool[i].ChildMask);
+            }
+        }
+        rootRank = computeRank(root.ChildMask);
+    }
+
+    updateTables(dirty);
+}
+
+// Updates the level of detail and aggregate tables after an edit. Every node on an edited path has its entry in
+// dirty.NodeRanges: nodes that were written, and their ancestors, which are either written as well or marked by
+// editTile and combineNodes. Only those are revisited, from the root down, and the clean children in between
+// contribute their stored entries.
+void SparseVoxelTree::updateTables(const SparseVoxelTreeDirtyRegion& dirty)
+{
+    if (HasLodTable())
+    {
+        nodeMaterials.resize(std::max<size_t>(nodePool.size(), 1));
+        nodeVoxelCounts.resize(nodeMaterials.size());
+        uint64_t count = 0;
+        rootMaterial = buildLod(root, rootScale, count, &dirty);
+    }
+    if (HasAggregateTable())
+    {
+        nodeAggregates.resize(std::max<size_t>(nodePool.size(), 1));
+        rootAggregate = buildAggregates(root, rootScale, &dirty);
+    }
+}
+
+// Moves the table entries to a new node pool, given the old index of every new node. Nodes without one
+// (UINT32_MAX) are recomputed, which requires their ancestors to lack one as well.
+void SparseVoxelTree::remapTables(const std::vector<uint32_t>& sources)
+{
+    SparseVoxelTreeDirtyRegion dirty;
+    for (uint32_t i = 0; i < sources.size(); ++i)
+    {
+        if (sources[i] != UINT32_MAX)
+        {
+            continue;
+        }
+        if (!dirty.NodeRanges.empty() && dirty.NodeRanges.back().second == i)
+        {
+            dirty.NodeRanges.back().second = i + 1;
+        }
+        else
+        {
+            dirty.NodeRanges.push_back({ i, i + 1 });
+        }
+    }
+
+    auto remap = [&](auto& table)
+    {
+        std::remove_reference_t<decltype(table)> newTable(std::max<size_t>(sources.size(), 1));
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            if (sources[i] != UINT32_MAX)
+            {
+                newTable[i] = table[sources[i]];
+            }
+        }
+        table = std::move(newTable);
+    };
+
+    if (HasLodTable())
+    {
+        remap(nodeMaterials);
+        remap(nodeVoxelCounts);
+    }
+    if (HasAggregateTable())
+    {
+        remap(nodeAggregates);
+    }
+    updateTables(dirty);
+}
+
+bool SparseVoxelTree::isDirtyNode(const SparseVoxelTreeDirtyRegion& dirty, uint32_t index)
+{
+    // The ranges are sorted and merged by finishEdit
+    auto it = std::upper_bound(dirty.NodeRanges.begin(), dirty.NodeRanges.end(), index,
+                               [](uint32_t value, const std::pair<uint32_t, uint32_t>& range) { return value < range.first; });
+    return it != dirty.NodeRanges.begin() && index < std::prev(it)->second;
+}
+
+SparseVoxelTreeDirtyRegion SparseVoxelTree::Combine(const SparseVoxelTree& other, SparseVoxelTreeCsgOp op)
+{
+    SparseVoxelTreeDirtyRegion dirty;
+
+    // Blocks of this tree are released while the other tree is read, so combining with itself goes through a copy
+    if (&other == this)
+    {
+        SparseVoxelTree copy = other;
+        return Combine(copy, op);
+    }
+
+    bool grows = op == SparseVoxelTreeCsgOp::Union || op == SparseVoxelTreeCsgOp::Overlay;
+    if (grows)
+    {
+        // Grow the root until it covers the other tree; the old root becomes the first child of the new one
+        while (rootScale < other.rootScale)
+        {
+            SparseVoxelTreeNode newRoot = {};
+            if (root.ChildMask != 0)
+            {
+                newRoot.ChildMask = 1;
+                newRoot.ChildPtr = allocateNodes(1);
+                nodePool[newRoot.ChildPtr] = root;
+                shareArray(newRoot);
+                uint32_t ptr = newRoot.ChildPtr;
+                dirty.NodeRanges.push_back({ ptr, ptr + 1 });
+            }
+            root = newRoot;
+            rootScale += 2;
+            dirty.RootChanged = true;
+        }
+
+        dimensions = glm::max(dimensions, other.dimensions);
+        AABBMax = glm::max(AABBMax, other.AABBMax);
+    }
+
+    // Find the node of the other tree covering this tree's root region. Above the other tree's root there is
+    // a chain of virtual nodes with only their first child set; below it, the first child is followed down.
+    SparseVoxelTreeNode otherNode = {};
+    if (rootScale > other.rootScale)
+    {
+        otherNode.ChildMask = other.root.ChildMask != 0 ? 1 : 0;
+    }
+    else
+    {
+        otherNode = other.root;
+        for (int32_t scale = other.rootScale; scale > rootScale; scale -= 2)
+        {
+            otherNode = csgChild(other, otherNode, scale, 0);
+        }
+    }
+
+    SparseVoxelTreeNode newRoot = combineNodes(root, other, otherNode, rootScale, op, dirty);
+    if (newRoot.ChildMask != root.ChildMask || newRoot.ChildPtr != root.ChildPtr || newRoot.IsSolid != root.IsSolid)
+    {
+        dirty.RootChanged = true;
+    }
+    root = newRoot;
+    root.IsLeaf = rootScale == 2;
+
+    finishEdit(dirty);
+    return dirty;
+}
+
+SparseVoxelTreeNode SparseVoxelTree::combineNodes(const SparseVoxelTreeNode& node, const SparseVoxelTree& other, const SparseVoxelTreeNode& otherNode, int32_t scale,
+                                                  SparseVoxelTreeCsgOp op, SparseVoxelTreeDirtyRegion& dirty)
 {
-    // Clear existing data
-    nodePool.clear();
-    leafData.clear();
+    // Arrays are never written in place, so shared subtrees (DAG mode) stay intact. Like editTile, `node` holds
+    // one reference to its array, which moves to the result.
+    bool copyOnWrite = sharesArrays;
 
-    // Start generating the tree from the root
-    root = generateTree(voxelMap, 6, glm::ivec3(0, 0, 0));
-}
+    // Solid nodes decide the result on their own for some operations
+    if (otherNode.IsSolid || node.IsSolid)
+    {
+        bool keep = (op == SparseVoxelTreeCsgOp::Union && node.IsSolid) || (op == SparseVoxelTreeCsgOp::Intersect && otherNode.IsSolid);
+        if (keep)
+        {
+            return node;
+        }
+        if (otherNode.IsSolid && (op == SparseVoxelTreeCsgOp::Subtract || op == SparseVoxelTreeCsgOp::Overlay))
+        {
+            releaseSubtree(node, scale);
+            if (op == SparseVoxelTreeCsgOp::Subtract)
+            {
+                return {};
+            }
+            voxelCount += 1ull << (3 * scale);
+            return makeSolid(scale, otherNode.ChildPtr);
+        }
+    }
 
-// Function to count the total number of voxels in the tree
-size_t SparseVoxelTree::GetTotalVoxels() const
-{
-    return leafData.size();
+    if (scale == 2)
+    {
+        // Merge the two tiles voxel by voxel
+        alignas(64) uint8_t tile[64] = { 0 };
+        alignas(64) uint8_t otherTile[64] = { 0 };
+        uint32_t count = node.IsSolid ? 0 : popcount64(node.ChildMask);
+        if (node.IsSolid)
+        {
+            std::fill(tile, tile + 64, static_cast<uint8_t>(node.ChildPtr));
+        }
+        uint32_t slot = 0;
+        for (uint64_t bits = count != 0 ? node.ChildMask : 0; bits != 0; bits &= bits - 1)
+        {
+            tile[std::countr_zero(bits)] = leafData[node.ChildPtr + slot++];
+        }
+        if (otherNode.IsSolid)
+        {
+            std::fill(otherTile, otherTile + 64, static_cast<uint8_t>(otherNode.ChildPtr));
+        }
+        slot = 0;
+        for (uint64_t bits = otherNode.IsSolid ? 0 : otherNode.ChildMask; bits != 0; bits &= bits - 1)
+        {
+            otherTile[std::countr_zero(bits)] = other.leafData[otherNode.ChildPtr + slot++];
+        }
+
+        for (int32_t i = 0; i < 64; ++i)
+        {
+            switch (op)
+            {
+            case SparseVoxelTreeCsgOp::Union:
+                tile[i] = tile[i] != 0 ? tile[i] : otherTile[i];
+                break;
+            case SparseVoxelTreeCsgOp::Subtract:
+                tile[i] = otherTile[i] != 0 ? 0 : tile[i];
+                break;
+            case SparseVoxelTreeCsgOp::Intersect:
+                tile[i] = otherTile[i] != 0 ? tile[i] : 0;
+                break;
+            case SparseVoxelTreeCsgOp::Overlay:
+                tile[i] = otherTile[i] != 0 ? otherTile[i] : tile[i];
+                break;
+            }
+        }
+
+        uint64_t mask = PackBits64(tile);
+        uint32_t oldVoxels = popcount64(node.ChildMask);
+
+        if (options.CollapseSolid && mask == ~0ull && std::all_of(tile, tile + 64, [&](uint8_t voxel) { return voxel == tile[0]; }))
+        {
+            if (node.IsSolid && node.ChildPtr == tile[0])
+            {
+                return node;
+            }
+            dropReference(node);
+            voxelCount = voxelCount + 64 - oldVoxels;
+            return makeSolid(2, tile[0]);
+        }
+
+        LeftPack(tile, mask);
+        uint32_t newCount = popcount64(mask);
+
+        if (!node.IsSolid && mask == node.ChildMask && std::equal(tile, tile + count, leafData.begin() + node.ChildPtr))
+        {
+            return node;
+        }
+
+        SparseVoxelTreeNode result = {};
+        result.IsLeaf = 1;
+        result.ChildMask = mask;
+        result.ChildPtr = allocateLeafData(newCount);
+        std::copy(tile, tile + newCount, leafData.begin() + result.ChildPtr);
+        shareArray(result);
+        uint32_t ptr = result.ChildPtr;
+        dirty.LeafDataRanges.push_back({ ptr, ptr + newCount });
+        dropReference(node);
+
+        voxelCount = voxelCount + newCount - oldVoxels;
+        return result;
+    }
+
+    // Children that have to be looked at: the other side only matters where it is set
+    uint64_t mask = node.ChildMask;
+    uint64_t visit = 0;
+    switch (op)
+    {
+    case SparseVoxelTreeCsgOp::Union:
+    case SparseVoxelTreeCsgOp::Overlay:
+        visit = otherNode.ChildMask;
+        break;
+    case SparseVoxelTreeCsgOp::Subtract:
+        visit = node.ChildMask & otherNode.ChildMask;
+        break;
+    case SparseVoxelTreeCsgOp::Intersect:
+        visit = node.ChildMask & otherNode.ChildMask;
+        mask = visit;
+        break;
+    }
+
+    SparseVoxelTreeNode children[64];
+    uint64_t newMask = 0;
+    uint32_t newCount = 0;
+    bool changed = mask != node.ChildMask;
+    uint32_t slot = 0;
+
+    // Children carried over from this node's array, which take a reference of their own in the new array
+    uint64_t carried = 0;
+
+    for (uint64_t bits = node.ChildMask | visit; bits != 0; bits &= bits - 1)
+    {
+        int32_t index = std::countr_zero(bits);
+        uint64_t bit = 1ull << index;
+
+        // The children of a solid node are solid as well
+        SparseVoxelTreeNode child = {};
+        child.IsLeaf = scale == 4;
+        if (node.ChildMask & bit)
+        {
+            child = node.IsSolid ? makeSolid(scale - 2, node.ChildPtr) : nodePool[node.ChildPtr + slot++];
+        }
+
+        bool fromArray = !node.IsSolid && (node.ChildMask & bit);
+        bool carry = false;
+        if (visit & bit)
+        {
+            // As in editTile, the copy of the entry takes its own reference before it is combined
+            if (copyOnWrite && fromArray)
+            {
+                addReference(child);
+            }
+
+            size_t dirtyCount = dirty.NodeRanges.size() + dirty.LeafDataRanges.size();
+            SparseVoxelTreeNode otherChildNode = csgChild(other, otherNode, scale, index);
+            SparseVoxelTreeNode newChild = (node.ChildMask & bit)
+                ? combineNodes(child, other, otherChildNode, scale - 2, op, dirty)
+                : copySubtree(other, otherChildNode, scale - 2, dirty);
+            bool childChanged = newChild.ChildMask != child.ChildMask || newChild.ChildPtr != child.ChildPtr || newChild.IsSolid != child.IsSolid;
+            if (copyOnWrite && fromArray && !childChanged)
+            {
+                dropReference(child);
+                carry = true;
+            }
+
+            // A child array that was released and allocated again can land at the same offset, leaving the child's
+            // entry as it was while its subtree changed. The entry is marked for the level of detail table then.
+            if (!childChanged && !node.IsSolid && (node.ChildMask & bit) && (HasLodTable() || HasAggregateTable()) &&
+                dirty.NodeRanges.size() + dirty.LeafDataRanges.size() != dirtyCount)
+            {
+                dirty.NodeRanges.push_back({ node.ChildPtr + slot - 1, node.ChildPtr + slot });
+            }
+            changed |= childChanged;
+            child = newChild;
+        }
+        else if (!(mask & bit))
+        {
+            // In DAG mode the child's reference goes with this node's array
+            if (copyOnWrite)
+            {
+                voxelCount -= countVoxels(child, scale - 2);
+            }
+            else
+            {
+                releaseSubtree(child, scale - 2);
+            }
+            continue;
+        }
+        else
+        {
+            carry = fromArray;
+        }
+
+        if (child.ChildMask != 0)
+        {
+            carried |= carry ? 1ull << newCount : 0;
+            children[newCount++] = child;
+            newMask |= bit;
+        }
+    }
+
+    if (!changed)
+    {
+        return node;
+    }
+
+    if (copyOnWrite)
+    {
+        for (uint64_t bits = carried; bits != 0; bits &= bits - 1)
+        {
+            addReference(children[std::countr_zero(bits)]);
+        }
+    }
+    dropReference(node);
+
+    SparseVoxelTreeNode result = {};
+    result.ChildMask = newMask;
+    if (collapseChildren(result, children))
+    {
+        return result;
+    }
+
+    result.ChildPtr = allocateNodes(newCount);
+    std::copy(children, children + newCount, nodePool.begin() + result.ChildPtr);
+    shareArray(result);
+    if (newCount != 0)
+    {
+        uint32_t ptr = result.ChildPtr;
+        dirty.NodeRanges.push_back({ ptr, ptr + newCount });
+    }
+    return result;
 }
 
-// Function to get the voxel data at a specific coordinate
-uint8_t SparseVoxelTree::At(int32_t x, int32_t y, int32_t z) const
+SparseVoxelTreeNode SparseVoxelTree::copySubtree(const SparseVoxelTree& other, const SparseVoxelTreeNode& otherNode, int32_t scale, SparseVoxelTreeDirtyRegion& dirty)
 {
-    return at(root, 6, glm::ivec3(0, 0, 0), x, y, z);
+    if (otherNode.IsSolid)
+    {
+        voxelCount += 1ull << (3 * scale);
+        return makeSolid(scale, otherNode.ChildPtr);
+    }
+
+    SparseVoxelTreeNode result = {};
+    result.IsLeaf = scale == 2;
+    result.ChildMask = otherNode.ChildMask;
+    uint32_t count = popcount64(otherNode.ChildMask);
+
+    if (scale == 2)
+    {
+        result.ChildPtr = allocateLeafData(count);
+        std::copy(other.leafData.begin() + otherNode.ChildPtr, other.leafData.begin() + otherNode.ChildPtr + count, leafData.begin() + result.ChildPtr);
+        shareArray(result);
+        uint32_t ptr = result.ChildPtr;
+        dirty.LeafDataRanges.push_back({ ptr, ptr + count });
+        voxelCount += count;
+        return result;
+    }
+
+    // Children first, so the pools keep their post-order layout
+    SparseVoxelTreeNode children[64];
+    for (uint64_t bits = otherNode.ChildMask, i = 0; bits != 0; bits &= bits - 1, ++i)
+    {
+        children[i] = copySubtree(other, csgChild(other, otherNode, scale, std::countr_zero(bits)), scale - 2, dirty);
+    }
+
+    result.ChildPtr = allocateNodes(count);
+    std::copy(children, children + count, nodePool.begin() + result.ChildPtr);
+    shareArray(result);
+    if (count != 0)
+    {
+        uint32_t ptr = result.ChildPtr;
+        dirty.NodeRanges.push_back({ ptr, ptr + count });
+    }
+    return result;
 }
 
-VoxelMap SparseVoxelTree::ToVoxelMap() const
+void SparseVoxelTree::releaseSubtree(const SparseVoxelTreeNode& node, int32_t scale)
 {
-    VoxelMap voxelMap;
-    voxelMap.size_x = 64; // Replace with the actual size if known
-    voxelMap.size_y = 64; // Replace with the actual size if known
-    voxelMap.size_z = 64; // Replace with the actual size if known
-    voxelMap.voxels.resize(voxelMap.size_x * voxelMap.size_y * voxelMap.size_z, 0);
+    // Shared arrays only lose this node's reference, and release their own children with the last one
+    if (sharesArrays)
+    {
+        voxelCount -= countVoxels(node, scale);
+        dropReference(node);
+        return;
+    }
 
-    fillVoxelMap(voxelMap, root, 6, glm::ivec3(0, 0, 0));
-    return voxelMap;
+    if (node.IsSolid)
+    {
+        voxelCount -= 1ull << (3 * scale);
+        return;
+    }
+
+    uint32_t count = popcount64(node.ChildMask);
+    if (scale == 2)
+    {
+        voxelCount -= count;
+        releaseLeafData(node.ChildPtr, count);
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        releaseSubtree(nodePool[node.ChildPtr + i], scale - 2);
+    }
+    releaseNodes(node.ChildPtr, count);
 }
 
-void SparseVoxelTree::PrintTree() const
+// Replaces the node's new child array by an identical one already in the tree (DAG mode), releasing the new
+// one with the references its entries took. Otherwise the new array is added to the index.
+void SparseVoxelTree::shareArray(SparseVoxelTreeNode& node)
 {
-    printTree(root, 6, glm::ivec3(0, 0, 0), 0);
+    if (!sharesArrays || node.IsSolid || node.ChildMask == 0)
+    {
+        return;
+    }
+
+    auto& arrays = node.IsLeaf ? leafArrays : nodeArrays;
+    auto [it, inserted] = arrays.try_emplace(arrayKey(node), static_cast<uint32_t>(node.ChildPtr));
+    if (inserted)
+    {
+        return;
+    }
+
+    SparseVoxelTreeNode copy = node;
+    node.ChildPtr = it->second;
+    addReference(node);
+    dropReference(copy);
 }
 
-SparseVoxelTreeNode SparseVoxelTree::generateTree(const VoxelMap& voxelMap, int32_t scale, glm::ivec3 pos)
+void SparseVoxelTree::addReference(const SparseVoxelTreeNode& node)
 {
-    SparseVoxelTreeNode node = {};
+    if (node.IsSolid || node.ChildMask == 0)
+    {
+        return;
+    }
 
-    // Create leaf
-    if (scale == 2)
+    // Arrays missing from the map have a single reference
+    auto& references = node.IsLeaf ? leafDataReferences : nodeReferences;
+    auto [it, inserted] = references.try_emplace(node.ChildPtr, 2);
+    if (!inserted)
     {
-        assert((pos.x | pos.y | pos.z) % 4 == 0);
+        ++it->second;
+    }
+}
 
-        // Repack voxels into 4x4x4 tile
-        alignas(64) uint8_t temp[64] = { 0 };
+// Drops one reference to the node's child array. With the last one the array is released, and in DAG mode it
+// leaves the index and drops the references of its own entries. Without sharing every array has a single
+// reference, and its entries are moved rather than dropped by the edit functions.
+void SparseVoxelTree::dropReference(const SparseVoxelTreeNode& node)
+{
+    if (node.IsSolid || node.ChildMask == 0)
+    {
+        return;
+    }
 
-        for (int32_t i = 0; i < 64; ++i)
+    uint32_t count = popcount64(node.ChildMask);
+    if (sharesArrays)
+    {
+        auto& references = node.IsLeaf ? leafDataReferences : nodeReferences;
+        auto it = references.find(node.ChildPtr);
+        if (it != references.end())
         {
-            int32_t x = pos.x + (i & 3);
-            int32_t y = pos.y + ((i >> 2) & 3);
-            int32_t z = pos.z + ((i >> 4) & 3);
-
-            if (static_cast<uint32_t>(x) < voxelMap.size_x &&
-                static_cast<uint32_t>(y) < voxelMap.size_y &&
-                static_cast<uint32_t>(z) < voxelMap.size_z)
+            if (--it->second == 1)
             {
-                int32_t index = x + y * voxelMap.size_x + z * voxelMap.size_x * voxelMap.size_y;
-                temp[i] = voxelMap.voxels[index];
+                references.erase(it);
             }
+            return;
         }
 
-        node.IsLeaf = 1;
-        node.ChildMask = PackBits64(temp); // Generate bitmask of `temp[i] != 0`.
-
-        LeftPack(temp, node.ChildMask); // "Remove" entries where respective mask bit is zero.
-        node.ChildPtr = leafData.size();
-        leafData.insert(leafData.end(), temp, temp + popcount64(node.ChildMask));
+        // A duplicate released by shareArray was never added to the index
+        auto& arrays = node.IsLeaf ? leafArrays : nodeArrays;
+        auto found = arrays.find(arrayKey(node));
+        if (found != arrays.end() && found->second == node.ChildPtr)
+        {
+            arrays.erase(found);
+        }
+        for (uint32_t i = 0; i < count && !node.IsLeaf; ++i)
+        {
+            dropReference(nodePool[node.ChildPtr + i]);
+        }
+    }
 
-        return node;
+    if (node.IsLeaf)
+    {
+        releaseLeafData(node.ChildPtr, count);
+    }
+    else
+    {
+        releaseNodes(node.ChildPtr, count);
     }
+}
 
-    // Descend
-    scale -= 2;
+// Rebuilds the reference counts and the contents index of a deduplicated tree from its nodes
+void SparseVoxelTree::indexArrays()
+{
+    nodeReferences.clear();
+    leafDataReferences.clear();
+    nodeArrays.clear();
+    leafArrays.clear();
 
-    std::vector<SparseVoxelTreeNode> children;
+    indexArray(root);
+    std::erase_if(nodeReferences, [](const auto& entry) { return entry.second == 1; });
+    std::erase_if(leafDataReferences, [](const auto& entry) { return entry.second == 1; });
+}
 
-    for (int32_t i = 0; i < 64; ++i)
+void SparseVoxelTree::indexArray(const SparseVoxelTreeNode& node)
+{
+    if (node.IsSolid || node.ChildMask == 0)
     {
-        glm::ivec3 childPos = glm::ivec3((i & 3), ((i >> 2) & 3), ((i >> 4) & 3));
-        SparseVoxelTreeNode child = generateTree(voxelMap, scale, pos + (childPos << scale));
+        return;
+    }
 
-        if (child.ChildMask != 0)
-        {
-            node.ChildMask |= 1ull << i;
-            children.push_back(child);
-        }
+    // Arrays are counted once per reference but indexed and descended into only once
+    auto& references = node.IsLeaf ? leafDataReferences : nodeReferences;
+    if (++references[node.ChildPtr] > 1)
+    {
+        return;
     }
 
-    node.ChildPtr = nodePool.size();
-    nodePool.insert(nodePool.end(), children.begin(), children.end());
+    (node.IsLeaf ? leafArrays : nodeArrays).try_emplace(arrayKey(node), static_cast<uint32_t>(node.ChildPtr));
+    for (int32_t i = 0; i < popcount64(node.ChildMask) && !node.IsLeaf; ++i)
+    {
+        indexArray(nodePool[node.ChildPtr + i]);
+    }
+}
 
-    return node;
+// Keys a child array by the mask and the raw bytes of its entries, like deduplicate
+std::string SparseVoxelTree::arrayKey(const SparseVoxelTreeNode& node) const
+{
+    std::string key(reinterpret_cast<const char*>(&node.ChildMask), sizeof(node.ChildMask));
+    uint32_t count = popcount64(node.ChildMask);
+    if (node.IsLeaf)
+    {
+        key.append(reinterpret_cast<const char*>(leafData.data() + node.ChildPtr), count);
+    }
+    else
+    {
+        key.append(reinterpret_cast<const char*>(nodePool.data() + node.ChildPtr), count * sizeof(SparseVoxelTreeNode));
+    }
+    return key;
 }
 
-uint64_t SparseVoxelTree::PackBits64(const uint8_t* data)
+SparseVoxelTreeNode SparseVoxelTree::csgChild(const SparseVoxelTree& tree, const SparseVoxelTreeNode& node, int32_t scale, int32_t index)
 {
-    uint64_t mask = 0;
-    for (int i = 0; i < 64; ++i)
+    SparseVoxelTreeNode child = {};
+
+    // Nodes above the tree's root are virtual (see Combine): their only child is the next virtual node or the root
+    if (scale > tree.rootScale)
     {
-        if (data[i] != 0)
+        if (index == 0 && node.ChildMask != 0)
         {
-            mask |= 1ull << i;
+            child.ChildMask = 1;
+            if (scale - 2 == tree.rootScale)
+            {
+                child = tree.root;
+            }
         }
+        return child;
     }
-    return mask;
+
+    if (node.IsSolid)
+    {
+        return makeSolid(scale - 2, node.ChildPtr);
+    }
+
+    uint64_t bit = 1ull << index;
+    if (node.ChildMask & bit)
+    {
+        child = tree.nodePool[node.ChildPtr + popcount64(node.ChildMask & (bit - 1))];
+    }
+    return child;
+}
+
+uint64_t SparseVoxelTree::PackBits64(const uint8_t* data)
+{
+    return BitPack::PackBits64(data);
 }
 
 void SparseVoxelTree::LeftPack(uint8_t* data, uint64_t mask)
 {
-    int writeIndex = 0;
-    for (int i = 0; i < 64; ++i)
+    BitPack::LeftPack(data, mask);
+}
+
+int32_t SparseVoxelTree::childSlot(const SparseVoxelTreeNode& node, int32_t index) const
+{
+    if (nodeRanks.empty())
     {
-        if (mask & (1ull << i))
-        {
-            data[writeIndex++] = data[i];
-        }
+        return popcount64(node.ChildMask & ((1ull << index) - 1));
     }
+
+    // Look up the count below the 16-bit chunk and only popcount the bits below `index` within it
+    uint32_t rank = &node == &root ? rootRank : nodeRanks[&node - nodePool.data()];
+    int32_t chunk = index >> 4;
+    uint32_t chunkBits = static_cast<uint16_t>(node.ChildMask >> (chunk << 4)) & ((1u << (index & 15)) - 1);
+    return static_cast<int32_t>((rank >> (chunk << 3)) & 0xFF) + std::popcount(chunkBits);
 }
 
-uint8_t SparseVoxelTree::at(const SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 pos, int32_t x, int32_t y, int32_t z) const
+SparseVoxelTreeNode SparseVoxelTree::makeSolid(int32_t scale, uint8_t material)
 {
-    if (node.IsLeaf)
+    SparseVoxelTreeNode node = {};
+    node.IsLeaf = scale == 2;
+    node.IsSolid = 1;
+    node.ChildPtr = material;
+    node.ChildMask = ~0ull;
+    return node;
+}
+
+bool SparseVoxelTree::collapseLeaf(SparseVoxelTreeNode& leaf, std::vector<uint8_t>& leafData) const
+{
+    // The leaf's voxels must be the last ones in leafData, so they can be dropped again
+    if (!options.CollapseSolid || leaf.ChildMask != ~0ull)
     {
-        // Calculate the index within the 4x4x4 block
-        int32_t localX = x - pos.x;
-        int32_t localY = y - pos.y;
-        int32_t localZ = z - pos.z;
-        int32_t index = localX + localY * 4 + localZ * 16;
+        return false;
+    }
 
-        // Check if the voxel exists
-        if (node.ChildMask & (1ull << index))
-        {
-            // Calculate the index in the leafData array
-            int32_t dataIndex = node.ChildPtr + popcount64(node.ChildMask & ((1ull << index) - 1));
-            return leafData[dataIndex];
-        }
-        else
-        {
-            return 0;
-        }
+    const uint8_t* voxels = leafData.data() + leaf.ChildPtr;
+    if (!std::all_of(voxels, voxels + 64, [&](uint8_t voxel) { return voxel == voxels[0]; }))
+    {
+        return false;
     }
-    else
+
+    uint8_t material = voxels[0];
+    leafData.resize(leaf.ChildPtr);
+    leaf = makeSolid(2, material);
+    return true;
+}
+
+bool SparseVoxelTree::collapseChildren(SparseVoxelTreeNode& node, const SparseVoxelTreeNode* children) const
+{
+    if (!options.CollapseSolid || node.ChildMask != ~0ull)
     {
-        // Calculate the child index
-        int32_t childIndex = ((x - pos.x) >> (scale - 2)) + ((y - pos.y) >> (scale - 2)) * 4 + ((z - pos.z) >> (scale - 2)) * 16;
+        return false;
+    }
 
-        // Check if the child exists
-        if (node.ChildMask & (1ull << childIndex))
-        {
-            // Calculate the index in the nodePool array
-            int32_t childPtr = node.ChildPtr + popcount64(node.ChildMask & ((1ull << childIndex) - 1));
-            return at(nodePool[childPtr], scale - 2, pos + glm::ivec3((childIndex & 3) << (scale - 2), ((childIndex >> 2) & 3) << (scale - 2), ((childIndex >> 4) & 3) << (scale - 2)), x, y, z);
-        }
-        else
+    for (int32_t i = 0; i < 64; ++i)
+    {
+        if (!children[i].IsSolid || children[i].ChildPtr != children[0].ChildPtr)
         {
-            return 0;
+            return false;
         }
     }
+
+    node.IsSolid = 1;
+    node.ChildPtr = children[0].ChildPtr;
+    return true;
 }
 
-void SparseVoxelTree::fillVoxelMap(VoxelMap& voxelMap, const SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 pos) const
+uint64_t SparseVoxelTree::countVoxels(const SparseVoxelTreeNode& node, int32_t scale) const
 {
+    if (node.IsSolid)
+    {
+        return 1ull << (3 * scale);
+    }
     if (node.IsLeaf)
     {
-        for (int32_t i = 0; i < 64; ++i)
+        return popcount64(node.ChildMask);
+    }
+
+    uint64_t count = 0;
+    for (int32_t i = 0; i < popcount64(node.ChildMask); ++i)
+    {
+        count += countVoxels(nodePool[node.ChildPtr + i], scale - 2);
+    }
+    return count;
+}
+
+// The scale is a template parameter so the child offsets are constant shifts and the recursion ends at the
+// leaves (scale 2) without a runtime check.
+template<int32_t Scale>
+void SparseVoxelTree::fillVoxelMap(VoxelMap& voxelMap, const SparseVoxelTreeNode& node, glm::ivec3 pos) const
+{
+    if (node.IsSolid)
+    {
+        // Fill the part of the node's region that lies inside the voxel map
+        glm::uvec3 end = glm::min(glm::uvec3(pos + (1 << Scale)), glm::uvec3(voxelMap.size_x, voxelMap.size_y, voxelMap.size_z));
+        for (uint32_t z = pos.z; z < end.z; ++z)
         {
-            if (node.ChildMask & (1ull << i))
+            for (uint32_t y = pos.y; y < end.y; ++y)
             {
-                int32_t localX = i & 3;          // x within the 4x4x4 block
-                int32_t localY = (i >> 2) & 3;   // y within the 4x4x4 block
-                int32_t localZ = (i >> 4) & 3;   // z within the 4x4x4 block
-                int32_t x = pos.x + localX;      // global x
-                int32_t y = pos.y + localY;      // global y
-                int32_t z = pos.z + localZ;      // global z
-
-                if (static_cast<uint32_t>(x) < voxelMap.size_x &&
-                    static_cast<uint32_t>(y) < voxelMap.size_y &&
-                    static_cast<uint32_t>(z) < voxelMap.size_z)
-                {
-                    int32_t index = x + y * voxelMap.size_x + z * voxelMap.size_x * voxelMap.size_y;
-                    int32_t dataIndex = node.ChildPtr + popcount64(node.ChildMask & ((1ull << i) - 1));
-                    voxelMap.voxels[index] = leafData[dataIndex];
-                }
+                size_t row = y * static_cast<size_t>(voxelMap.size_x) + z * static_cast<size_t>(voxelMap.size_x) * voxelMap.size_y;
+                std::fill(voxelMap.voxels.begin() + row + pos.x, voxelMap.voxels.begin() + row + std::max<uint32_t>(end.x, pos.x), static_cast<uint8_t>(node.ChildPtr));
             }
         }
+        return;
     }
-    else
+
+    constexpr int32_t childScale = Scale - 2;
+    int32_t slot = 0;
+    for (uint64_t mask = node.ChildMask; mask != 0; mask &= mask - 1, ++slot)
     {
-        scale -= 2;
-        for (int32_t i = 0; i < 64; ++i)
+        int32_t i = std::countr_zero(mask);
+        glm::ivec3 childPos = pos + glm::ivec3((i & 3) << childScale, ((i >> 2) & 3) << childScale, ((i >> 4) & 3) << childScale);
+
+        if constexpr (childScale == 0)
         {
-            if (node.ChildMask & (1ull << i))
+            if (static_cast<uint32_t>(childPos.x) < voxelMap.size_x &&
+                static_cast<uint32_t>(childPos.y) < voxelMap.size_y &&
+                static_cast<uint32_t>(childPos.z) < voxelMap.size_z)
             {
-                int32_t childPtr = node.ChildPtr + popcount64(node.ChildMask & ((1ull << i) - 1));
-                glm::ivec3 childPos = pos + glm::ivec3((i & 3) << scale, ((i >> 2) & 3) << scale, ((i >> 4) & 3) << scale);
-                fillVoxelMap(voxelMap, nodePool[childPtr], scale, childPos);
+                size_t index = childPos.x + childPos.y * static_cast<size_t>(voxelMap.size_x) + childPos.z * static_cast<size_t>(voxelMap.size_x) * voxelMap.size_y;
+                voxelMap.voxels[index] = leafData[node.ChildPtr + slot];
             }
         }
+        else
+        {
+            fillVoxelMap<childScale>(voxelMap, nodePool[node.ChildPtr + slot], childPos);
+        }
     }
 }
 
@@ -241,7 +3088,7 @@ void SparseVoxelTree::printTree(const SparseVoxelTreeNode& node, int32_t scale,
 
     // Print node information
     std::cout << "Node at depth " << depth << ", position (" << pos.x << ", " << pos.y << ", " << pos.z << "): ";
-    std::cout << "IsLeaf: " << node.IsLeaf << ", ChildMask: ";
+    std::cout << "IsLeaf: " << node.IsLeaf << ", IsSolid: " << node.IsSolid << ", ChildMask: ";
 
     // Print the child mask as a binary number
     for (int i = 63; i >= 0; --i)
@@ -250,7 +3097,11 @@ void SparseVoxelTree::printTree(const SparseVoxelTreeNode& node, int32_t scale,
         if (i % 8 == 0) std::cout << " "; // Add a space every 8 bits for readability
     }
 
-    if (node.IsLeaf)
+    if (node.IsSolid)
+    {
+        std::cout << ", Material: " << node.ChildPtr;
+    }
+    else if (node.IsLeaf)
     {
         std::cout << ", Voxel Data: ";
         for (int i = 0; i < 64; ++i)
@@ -265,7 +3116,7 @@ void SparseVoxelTree::printTree(const SparseVoxelTreeNode& node, int32_t scale,
     std::cout << std::endl;
 
     // If not a leaf, recursively print children
-    if (!node.IsLeaf)
+    if (!node.IsLeaf && !node.IsSolid)
     {
         scale -= 2;
         for (int32_t i = 0; i < 64; ++i)
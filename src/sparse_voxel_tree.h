@@ -1,5 +1,14 @@
 #pragma once
+#include <array>
+#include <bit>
+#include <cassert>
 #include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -7,57 +16,392 @@
 #include <iostream>
 
 class VoxelTreeMemoryAllocator;
+class VoxelTreeAccessor;
+class CompactSparseVoxelTree;
+class WorkStealingPool;
 
 struct [[gnu::packed]] SparseVoxelTreeNode
 {
     uint32_t IsLeaf : 1;     // Indicates if this node is a leaf containing plain voxels.
-    uint32_t ChildPtr : 31;  // Absolute offset to array of existing child nodes/voxels.
-    uint64_t ChildMask;      // Indicates which children/voxels are present in array.
+    uint32_t IsSolid : 1;    // Indicates the whole node is filled with one material, stored in ChildPtr.
+    uint32_t ChildPtr : 30;  // Absolute offset to array of existing child nodes/voxels, or the material of a solid node.
+    uint64_t ChildMask;      // Indicates which children/voxels are present in array. Always full for solid nodes.
+};
+
+// Order in which the child arrays of internal nodes are laid out in the node pool. Siblings always stay
+// contiguous; the layout decides where each child array sits relative to its parent's.
+enum class SparseVoxelTreeLayout
+{
+    PostOrder,    // Children before their parent, as generated
+    BreadthFirst, // Level by level, root first
+    DepthFirst,   // Pre-order: a parent's children array right before its descendants
+    VanEmdeBoas   // Cache-oblivious: the top half of the levels first, then each bottom subtree recursively
+};
+
+struct SparseVoxelTreeOptions
+{
+    // Share identical subtrees, turning the tree into a directed acyclic graph (DAG). Leaves with the same
+    // mask and voxels, and internal nodes with the same mask and children, point at a single copy.
+    // Traversal is unaffected since every node still addresses a contiguous child array.
+    bool Deduplicate = false;
+
+    // Node pool layout applied after generation, see Reorder.
+    SparseVoxelTreeLayout Layout = SparseVoxelTreeLayout::PostOrder;
+
+    // Build the level of detail table after generation, see BuildLodTable.
+    bool BuildLod = false;
+
+    // Replace subtrees (and leaves) filled with a single material by one solid node, which has no children and
+    // no leaf data. Lookups and traversals stop at solid nodes, and edits split them again where needed.
+    bool CollapseSolid = true;
+
+    // Build the aggregate table after generation, see BuildAggregateTable.
+    bool BuildAggregates = false;
+
+    // Remove interior voxels after generation, before deduplication, see SparseVoxelTree::Hollow.
+    bool Hollow = false;
+};
+
+// Statistics of the voxels in a node's region, see SparseVoxelTree::BuildAggregateTable
+struct SparseVoxelTreeAggregate
+{
+    uint64_t VoxelCount;       // Number of non-empty voxels
+    uint64_t MaterialMask[4];  // Bit m is set if material m occurs
+    uint8_t MinMaterial;       // Smallest and largest material that occurs, 0 for empty nodes
+    uint8_t MaxMaterial;
+};
+
+// Ranges of nodePool and leafData entries written by an edit, as [first, second) index pairs, so only those
+// need to be uploaded again. With a level of detail or aggregate table, NodeRanges also covers the nodes on the
+// edited paths, whose table entries may have changed. The pools may also have grown. RootChanged is set if the
+// root node was modified.
+struct SparseVoxelTreeDirtyRegion
+{
+    std::vector<std::pair<uint32_t, uint32_t>> NodeRanges;
+    std::vector<std::pair<uint32_t, uint32_t>> LeafDataRanges;
+    bool RootChanged = false;
+};
+
+// Boolean operation between two trees, see SparseVoxelTree::Combine
+enum class SparseVoxelTreeCsgOp
+{
+    Union,     // Voxels of either tree; this tree's material where both are set
+    Subtract,  // Voxels of this tree that are empty in the other
+    Intersect, // Voxels set in both trees, with this tree's material
+    Overlay    // Voxels of either tree; the other tree's material where both are set
+};
+
+// Supplies the voxels of a volume to SparseVoxelTree::GenerateTreeStreaming one slab of z-slices at a time.
+// Called with increasing z; must fill `slab` with the slices [z, z + depth), laid out like VoxelMap::voxels.
+using SparseVoxelSlabReader = std::function<void(uint32_t z, uint32_t depth, std::span<uint8_t> slab)>;
+
+// Ray in the voxel space of a tree, see SparseVoxelTree::RaycastBatch. Distances along the ray are measured in
+// multiples of Direction, which does not need to be normalized.
+struct SparseVoxelRay
+{
+    glm::vec3 Origin;
+    glm::vec3 Direction;
+};
+
+// Result of a ray query. Everything but Hit is only valid when Hit is set.
+struct SparseVoxelRayHit
+{
+    bool Hit = false;
+    float Distance = 0.0f;              // Where the ray entered the hit voxel
+    glm::ivec3 Voxel = glm::ivec3(0);   // Voxel that was hit
+    glm::ivec3 Normal = glm::ivec3(0);  // Face the ray entered through, zero if it started inside the voxel
+    uint8_t Material = 0;
+};
+
+// What a ray query reports, see SparseVoxelTree::RaycastBatch
+enum class SparseVoxelRayMode
+{
+    Nearest, // Every field of the nearest hit
+    AnyHit   // Only whether something was hit, with its Distance and Voxel, for occlusion and line of sight
 };
 
 class SparseVoxelTree
 {
 public:
-    SparseVoxelTree(const VoxelMap& voxelMap);
+    // Smallest and largest supported root scale. Each level covers 4x more voxels per axis, so a
+    // root scale of 12 spans 4096^3 voxels and the maximum spans 2^30 voxels per axis.
+    static constexpr int32_t MinRootScale = 2;
+    static constexpr int32_t MaxRootScale = 30;
+
+    SparseVoxelTree(const VoxelMap& voxelMap, const SparseVoxelTreeOptions& options = {});
+    SparseVoxelTree(const SparseVoxelList& voxelList, const SparseVoxelTreeOptions& options = {});
+
+    // Loads a tree file written by GenerateTreeStreaming, see LoadTree.
+    explicit SparseVoxelTree(const std::string& path, const SparseVoxelTreeOptions& options = {});
 
     /**
-     * @brief Recursively generates a Sparse Voxel Tree from a given voxel map.
+     * @brief Generates a Sparse Voxel Tree from a given voxel map.
      *
      * This function constructs a sparse voxel tree by subdividing the voxel map into a 4x4x4 grid at each level.
-     * The algorithm operates in two main cases:
+     * The tree is generated bottom-up in three steps:
+     *
+     * 1. Occupancy Pre-pass:
+     *    - A single scan of the voxel map marks which 4x4x4 tiles contain voxels, and every occupied cell then marks
+     *      its parent cell, giving one occupancy bitmap per level.
+     *    - The number of occupied cells and non-empty voxels is exactly the size of nodePool and leafData, so both
+     *      pools are reserved once up front.
      *
-     * 1. Leaf Node Creation (Base Case):
-     *    - When the scale is equal to 2, the function treats the current region as a leaf node, representing a 4x4x4 tile.
-     *    - It first asserts that the starting position is aligned on a 4-voxel grid.
-     *    - It then repacks the voxels within this 4x4x4 region into a temporary array.
+     * 2. Leaf Node Creation:
+     *    - The leaves are visited in Morton order, and the largest empty node starting at the current leaf is skipped
+     *      whole using the occupancy bitmaps.
+     *    - Each occupied 4x4x4 tile is repacked into a temporary array.
      *    - A bitmask is generated using the helper function PackBits64, where each bit corresponds to a voxel and is set
      *      if that voxel is non-zero.
      *    - The LeftPack function is used to "compress" the temporary array by removing entries for which the corresponding
      *      bit in the bitmask is zero.
      *    - The non-empty voxel data is then appended to a global container (leafData), and the node is marked as a leaf.
      *
-     * 2. Internal Node Creation (Recursive Case):
-     *    - For scales greater than 2, the function subdivides the current region into 64 smaller regions (a 4x4x4 grid).
-     *    - It computes the relative position of each child region and calls generateTree recursively with a reduced scale.
-     *    - If a child node contains any non-empty voxel data (indicated by a non-zero ChildMask), the corresponding bit
-     *      in the parent's ChildMask is set.
-     *    - All valid child nodes are collected in a temporary vector and then appended to a global node pool (nodePool).
-     *    - The parent's ChildPtr is updated to reference the starting index of its children in the nodePool.
+     * 3. Internal Node Creation:
+     *    - Every open internal node collects its non-empty children in a fixed 64-entry scratch array for its depth.
+     *    - Once the last leaf of a node has been visited, its children are appended to a global node pool (nodePool),
+     *      its ChildPtr is set to the start of that array, and the node is added to its parent's scratch array.
+     *    - Nodes are closed deepest first, so the pools are laid out in the same post-order as a recursive descent,
+     *      and no memory is allocated per node.
+     *
+     * The root scale is the smallest even scale whose region (2^scale voxels per axis) covers every dimension
+     * of the voxel map, so a 64^3 model gets a root scale of 6 and a 4096^3 model a root scale of 12.
      *
      * Parameters:
      * - voxelMap: The voxel map containing voxel data and its dimensions.
-     * - scale: The current scale level. When scale == 2, the region is treated as a leaf node (4x4x4 voxel tile).
-     * - pos: The starting 3D position (origin) in the voxel map for the current region.
-     *
-     * Returns:
-     * - A SparseVoxelTreeNode representing the current region in the voxel tree.
     */
     void GenerateTree(const VoxelMap& voxelMap);
 
+    /**
+     * @brief Generates the same tree as GenerateTree, building the subtrees under the root concurrently.
+     *
+     * Each of the 64 children of the root is built on a worker thread into its own node pool and leaf data,
+     * with child pointers relative to those buffers. The subtrees are then appended in child order and their
+     * pointers offset, so the resulting nodePool and leafData are byte-identical to the serial builder.
+     *
+     * Parameters:
+     * - voxelMap: The voxel map containing voxel data and its dimensions.
+     * - threadCount: Number of threads to build with (at most 64), or 0 to use every hardware thread.
+    */
+    void GenerateTreeParallel(const VoxelMap& voxelMap, uint32_t threadCount = 0);
+
+    /**
+     * @brief Generates the same tree as GenerateTree from a list of non-empty voxels, without a dense voxel map.
+     *
+     * The voxels are radix sorted by their path through the tree (a Morton order), then grouped into leaves
+     * and emitted bottom-up. Every open internal node keeps its children on a per-depth stack and is closed
+     * as soon as a leaf outside of it arrives, so the cost is O(voxels) instead of O(volume).
+     *
+     * Voxels with material 0 or outside of the list's dimensions are ignored, and for duplicate positions the
+     * last voxel in the list wins. Throws std::runtime_error for volumes larger than 2^21 voxels per axis.
+     *
+     * Parameters:
+     * - voxelList: The non-empty voxels and the dimensions of the volume.
+    */
+    void GenerateTree(const SparseVoxelList& voxelList);
+
+    /**
+     * @brief Builds a tree from a volume too large to hold in memory and writes it to a file.
+     *
+     * The volume is read through `readSlab` in slabs of `slabDepth` z-slices. Each 4x4x4 tile of a slab is
+     * packed into a leaf as in GenerateTree, and its voxels are written out straight away. Every level keeps
+     * one row of open nodes spanning the volume's x and y extent. A node is closed once the last slab inside
+     * it has been read: its children array is written out and the node is added to its parent. Peak memory is
+     * the slab plus the open node rows, about 3 bytes per voxel column, independent of the volume's depth.
+     *
+     * The file holds a header, the node pool and the leaf data. Child arrays are written in the order their
+     * parents close, which is a valid layout but not the post-order of GenerateTree. The leaf data goes to a
+     * temporary file (`path` + ".leafdata") until the node pool is complete.
+     *
+     * Only options.CollapseSolid is applied while building. Hollow, Deduplicate, Layout, BuildLod and
+     * BuildAggregates need the whole tree, so they are applied when the file is loaded with the options of the
+     * loading tree.
+     *
+     * Throws std::runtime_error if a file cannot be written or the pools outgrow the 30-bit ChildPtr.
+     *
+     * Parameters:
+     * - size: Dimensions of the volume.
+     * - readSlab: Called once per slab with increasing z.
+     * - path: File to write.
+     * - slabDepth: Number of z-slices per slab, a multiple of 4.
+    */
+    static void GenerateTreeStreaming(glm::uvec3 size, const SparseVoxelSlabReader& readSlab, const std::string& path,
+                                      const SparseVoxelTreeOptions& options = {}, uint32_t slabDepth = 16);
+
+    // Replaces the tree with one read from a file written by GenerateTreeStreaming, then applies this tree's
+    // Hollow, Deduplicate, Layout, BuildLod and BuildAggregates options. Throws std::runtime_error if the file
+    // cannot be read.
+    void LoadTree(const std::string& path);
+
+    // Precomputes per-node prefix counts of the 16-bit chunks of each ChildMask, so child slot lookups in At
+    // only need to count the bits of one chunk. Costs 4 bytes per node; discarded when the tree is regenerated.
+    void BuildRankTable();
+    void ClearRankTable();
+    bool HasRankTable() const { return !nodeRanks.empty(); }
+
+    // Computes a representative material for every node by a bottom-up majority vote: each child votes for its
+    // own representative material, weighted by its voxel count. Costs 9 bytes per node, the material and the
+    // voxel count, so edits and CSG operations only have to redo the votes along the paths they changed. Kept
+    // up to date by edits, CSG operations, Reorder and Hollow while present.
+    void BuildLodTable();
+    void ClearLodTable();
+    bool HasLodTable() const { return !nodeMaterials.empty(); }
+
+    // Returns the representative material of the node `level` levels below the root that contains the given
+    // position, or 0 if there is none. Level 0 is the root and level GetRootScale() / 2 the voxels themselves,
+    // where this matches At. Requires the level of detail table.
+    uint8_t SampleAtLevel(int32_t x, int32_t y, int32_t z, int32_t level) const;
+
+    // Returns the representative material of the node pool entry at `index`, or of the root. Requires the level
+    // of detail table. The root has no node pool entry, so renderers that upload the per-node materials stop
+    // one level below it at the coarsest: a MaxDepth of 0 draws the same as 1.
+    uint8_t GetNodeMaterial(uint32_t index) const { return nodeMaterials[index]; }
+    uint8_t GetRootMaterial() const { return rootMaterial; }
+
+    // Computes the voxel count, smallest and largest material and material presence mask of every node,
+    // bottom-up. Costs 48 bytes per node. Kept up to date by edits, CSG operations, Reorder and Hollow while
+    // present, which only recompute the nodes whose subtrees they changed.
+    void BuildAggregateTable();
+    void ClearAggregateTable();
+    bool HasAggregateTable() const { return !nodeAggregates.empty(); }
+
+    // Returns the aggregate of the node pool entry at `index`, or of the root. Requires the aggregate table.
+    const SparseVoxelTreeAggregate& GetNodeAggregate(uint32_t index) const { return nodeAggregates[index]; }
+    const SparseVoxelTreeAggregate& GetRootAggregate() const { return rootAggregate; }
+
+    /**
+     * @brief Region queries over the box [min, max), clipped to the root region.
+     *
+     * The tree is walked down to the nodes that are fully inside the box or on its boundary. Solid nodes are
+     * answered directly. With the aggregate table, a node fully inside the box is answered from its aggregate
+     * when the query does not need more (its voxel count, or a node holding a single material), and nodes
+     * whose presence mask lacks the queried material are skipped without visiting them. Without the table,
+     * those nodes are walked down to their leaves.
+     *
+     * - CountInBox: Number of non-empty voxels, or of voxels of `material`.
+     * - AnyInBox: Whether the box holds any non-empty voxel, or any voxel of `material`. Stops at the first.
+     * - MaterialHistogram: Number of voxels of every material; entry 0 is always 0.
+    */
+    uint64_t CountInBox(glm::ivec3 min, glm::ivec3 max) const;
+    uint64_t CountInBox(glm::ivec3 min, glm::ivec3 max, uint8_t material) const;
+    bool AnyInBox(glm::ivec3 min, glm::ivec3 max) const;
+    bool AnyInBox(glm::ivec3 min, glm::ivec3 max, uint8_t material) const;
+    std::array<uint64_t, 256> MaterialHistogram(glm::ivec3 min, glm::ivec3 max) const;
+
+    // Rearranges the child arrays in nodePool (and the voxels in leafData, in the order their leaves appear)
+    // into the given layout and remaps every ChildPtr. Lookups are unaffected; only memory locality changes.
+    void Reorder(SparseVoxelTreeLayout layout);
+
+    // Removes every voxel whose 26 neighbors (faces, edges and corners) are all occupied, and the leaves and
+    // nodes this leaves empty, so only a shell that can be seen from outside the model remains. Neighbors
+    // outside the root region count as empty. Solid nodes are kept whole, since they have no leaf data to
+    // save. The pools are rebuilt in post-order, with the subtrees of a deduplicated tree copied once per
+    // reference, so the tree no longer shares arrays afterwards.
+    void Hollow();
+
     size_t GetTotalVoxels() const;
 
+    // Options applied by GenerateTree and GenerateTreeParallel
+    const SparseVoxelTreeOptions& GetOptions() const { return options; }
+    void SetOptions(const SparseVoxelTreeOptions& newOptions) { options = newOptions; }
+
+    // Returns the scale of the root node; the tree spans 2^rootScale voxels along each axis.
+    int32_t GetRootScale() const { return rootScale; }
+
+    // Returns the dimensions of the voxel map the tree was generated from.
+    const glm::uvec3& GetDimensions() const { return dimensions; }
+
+    uint8_t At(int32_t x, int32_t y, int32_t z) const;
+
+    // Same as At for a tree whose root scale is known at compile time, such as fixed-size chunks. The level
+    // loop is unrolled, so the shifts and masks are constants and there are no leaf checks on the way down.
+    // RootScale must equal GetRootScale().
+    template<int32_t RootScale>
     uint8_t At(int32_t x, int32_t y, int32_t z) const;
 
+    // Calls `func` with a std::integral_constant<int32_t, GetRootScale()>, so code specialized on the root
+    // scale (such as At<RootScale>) can be selected once for a tree instead of per lookup.
+    template<typename Func, int32_t Scale = MinRootScale>
+    decltype(auto) DispatchRootScale(Func&& func) const;
+
+    // Looks up every position and writes its voxel to the matching entry of `results`, which must be at
+    // least as large as `positions`. Lookups are reordered by Morton code and walked down the tree in
+    // small interleaved groups so their memory latency overlaps, which pays off on trees larger than cache.
+    void At(std::span<const glm::ivec3> positions, std::span<uint8_t> results) const;
+
+    /**
+     * @brief Casts rays against the voxels of the tree on the CPU.
+     *
+     * Rays are given in the tree's voxel space, where voxel (x, y, z) spans [x, x + 1) and the root region
+     * starts at the origin; the transform is ignored. A ray hits the first non-empty voxel it enters at a
+     * distance in [0, maxDistance], so a segment from a to b is checked with Origin a, Direction b - a and a
+     * maxDistance of 1.
+     *
+     * Each ray walks the hierarchical DDA of hierarchical_dda.h: every step crosses the whole empty cell of the
+     * deepest node holding the current voxel, so open space costs a step per empty node rather than per voxel.
+     * Solid nodes are hit without descending. The traversal goes front to back, so with SparseVoxelRayMode::AnyHit
+     * the first voxel found ends the ray as well, but the material lookup and normal tracking are skipped.
+     *
+     * RaycastBatch writes the result of rays[i] to hits[i], which must be at least as large as `rays`. Rays
+     * are sorted by direction octant and then by origin in Morton order, so consecutive rays walk the same
+     * nodes in the same order. With a pool, runs of sorted rays are spread over its threads.
+     *
+     * Parameters:
+     * - maxDistance: Largest distance along the ray, in multiples of Direction.
+     * - pool: Threads to cast on, or null to cast on the calling thread.
+    */
+    SparseVoxelRayHit Raycast(const SparseVoxelRay& ray, float maxDistance, SparseVoxelRayMode mode = SparseVoxelRayMode::Nearest) const;
+    void RaycastBatch(std::span<const SparseVoxelRay> rays, std::span<SparseVoxelRayHit> hits, float maxDistance,
+                      SparseVoxelRayMode mode = SparseVoxelRayMode::Nearest, WorkStealingPool* pool = nullptr) const;
+
+    /**
+     * @brief Edits the tree in place without regenerating it.
+     *
+     * Edits are applied one 4x4x4 tile at a time: the leaf is unpacked, modified and packed again, and every
+     * child array along the path whose size changes is moved to a block of the new size. Blocks are taken from
+     * and returned to free lists per size class (1 to 64 entries) before the pools are grown. Nodes and leaves
+     * that become empty are removed, and missing ones are created. Solid nodes are split where an edit changes
+     * them, and nodes left filled with a single material are collapsed again.
+     *
+     * With SparseVoxelTreeOptions::Deduplicate, subtrees may be shared, so edits copy every modified array
+     * instead of writing in place. The tree keeps the reference count and the contents of every shared array:
+     * a new array identical to one already in the tree is replaced by it, and an array goes back to the free
+     * lists with its last reference. Edits that put voxels back therefore return the pools to their old size.
+     *
+     * A material of 0 erases. Positions outside of the root region are ignored. Boxes span [min, max).
+     * ApplyEdits sorts the edits into Morton order and applies each touched tile once; when several edits
+     * hit the same voxel, the last one wins.
+     *
+     * Returns:
+     * - The ranges of nodePool and leafData that were written.
+    */
+    SparseVoxelTreeDirtyRegion SetVoxel(int32_t x, int32_t y, int32_t z, uint8_t material);
+    SparseVoxelTreeDirtyRegion FillBox(glm::ivec3 min, glm::ivec3 max, uint8_t material);
+    SparseVoxelTreeDirtyRegion EraseBox(glm::ivec3 min, glm::ivec3 max);
+    SparseVoxelTreeDirtyRegion ApplyEdits(std::span<const SparseVoxel> edits);
+
+    /**
+     * @brief Combines another tree into this one without going through a voxel map.
+     *
+     * Both trees are walked together from the root, and at every level the child masks are combined
+     * (OR for Union and Overlay, ANDNOT for Subtract, AND for Intersect). Subtrees present on only one
+     * side are never descended into: this tree's are kept as they are, and the other tree's are copied
+     * over for Union and Overlay. Only leaves occupied in both trees are unpacked and merged, so the
+     * cost follows the overlapping occupied nodes rather than the volume.
+     *
+     * Both trees share the same voxel space, with their origins aligned; transforms are ignored. For
+     * Union and Overlay the root grows to cover the other tree. Changed child arrays are allocated
+     * and released through the same free lists as the edit functions. Subtrees dropped by Intersect
+     * are walked once more to release their blocks and update the voxel count.
+     *
+     * Returns:
+     * - The ranges of nodePool and leafData that were written.
+    */
+    SparseVoxelTreeDirtyRegion Combine(const SparseVoxelTree& other, SparseVoxelTreeCsgOp op);
+    SparseVoxelTreeDirtyRegion Union(const SparseVoxelTree& other) { return Combine(other, SparseVoxelTreeCsgOp::Union); }
+    SparseVoxelTreeDirtyRegion Subtract(const SparseVoxelTree& other) { return Combine(other, SparseVoxelTreeCsgOp::Subtract); }
+    SparseVoxelTreeDirtyRegion Intersect(const SparseVoxelTree& other) { return Combine(other, SparseVoxelTreeCsgOp::Intersect); }
+    SparseVoxelTreeDirtyRegion Overlay(const SparseVoxelTree& other) { return Combine(other, SparseVoxelTreeCsgOp::Overlay); }
+
     VoxelMap ToVoxelMap() const;
 
     void PrintTree() const;
@@ -68,12 +412,96 @@ public:
     const glm::mat4& GetTransform() const { return Transform; }
 
 private:
-    SparseVoxelTreeNode generateTree(const VoxelMap& voxelMap, int32_t scale, glm::ivec3 pos);
-    uint8_t at(const SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 pos, int32_t x, int32_t y, int32_t z) const;
-    void fillVoxelMap(VoxelMap& voxelMap, const SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 pos) const;
+    // Occupancy bitmaps of every level below the root, built by a pre-pass over the voxel map.
+    struct OccupancyPyramid
+    {
+        std::vector<std::vector<uint64_t>> levels; // levels[k] has one bit per node at scale 2k + 2, in raster order
+        std::vector<glm::uvec3> sizes;             // Grid size of each level
+        size_t voxelCount;                         // Number of non-empty voxels
+
+        void Build(const VoxelMap& voxelMap, int32_t rootScale);
+        bool IsOccupied(int32_t level, glm::ivec3 pos) const;
+        size_t CountNodes() const;
+    };
+
+    // Leaf generation and collapsing for BuildSparseTree
+    struct BuildSource;
+
+    SparseVoxelTreeNode generateTree(const VoxelMap& voxelMap, const OccupancyPyramid& occupancy, int32_t scale, glm::ivec3 pos,
+                                     std::vector<SparseVoxelTreeNode>& nodePool, std::vector<uint8_t>& leafData) const;
+    uint8_t buildLod(const SparseVoxelTreeNode& node, int32_t scale, uint64_t& count, const SparseVoxelTreeDirtyRegion* dirty);
+    SparseVoxelTreeAggregate buildAggregates(const SparseVoxelTreeNode& node, int32_t scale, const SparseVoxelTreeDirtyRegion* dirty);
 
-    uint64_t PackBits64(const uint8_t* data);
-    void LeftPack(uint8_t* data, uint64_t mask);
+    // State of a CountInBox, AnyInBox or MaterialHistogram query
+    struct BoxQuery
+    {
+        glm::ivec3 min;
+        glm::ivec3 max;
+        int32_t material;    // Only count this material, or -1 for every non-empty one
+        bool stopAtFirst;    // Stop as soon as count is non-zero
+        uint64_t* histogram; // Per-material counts to add to, if not null
+        uint64_t count;
+    };
+
+    template<bool AnyHit>
+    SparseVoxelRayHit raycast(const SparseVoxelRay& ray, float maxDistance) const;
+
+    void queryBox(BoxQuery& query) const;
+    void queryBox(const SparseVoxelTreeNode& node, const SparseVoxelTreeAggregate* aggregate, int32_t scale, glm::ivec3 pos, BoxQuery& query) const;
+    SparseVoxelTreeNode generateLeaf(const VoxelMap& voxelMap, glm::ivec3 pos, std::vector<uint8_t>& leafData) const;
+    int32_t childSlot(const SparseVoxelTreeNode& node, int32_t index) const;
+    static SparseVoxelTreeNode makeSolid(int32_t scale, uint8_t material);
+    bool collapseLeaf(SparseVoxelTreeNode& leaf, std::vector<uint8_t>& leafData) const;
+    bool collapseChildren(SparseVoxelTreeNode& node, const SparseVoxelTreeNode* children) const;
+    uint64_t countVoxels(const SparseVoxelTreeNode& node, int32_t scale) const;
+    void clearPools();
+    void clearFreeLists();
+    void clearArrayIndex();
+    void finishTree();
+
+    // Edit of a single 4x4x4 tile: voxels with their bit set in writeMask are replaced by values (0 erases)
+    struct TileEdit
+    {
+        uint64_t writeMask;
+        bool hasFills;
+        alignas(64) uint8_t values[64];
+    };
+
+    bool editTile(SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 tilePos, const TileEdit& edit, SparseVoxelTreeDirtyRegion& dirty);
+    bool collapseEdited(SparseVoxelTreeNode& node);
+    uint32_t allocateNodes(uint32_t count);
+    void releaseNodes(uint32_t ptr, uint32_t count);
+    uint32_t allocateLeafData(uint32_t count);
+    void releaseLeafData(uint32_t ptr, uint32_t count);
+    void finishEdit(SparseVoxelTreeDirtyRegion& dirty);
+    void updateTables(const SparseVoxelTreeDirtyRegion& dirty);
+    void remapTables(const std::vector<uint32_t>& sources);
+    static bool isDirtyNode(const SparseVoxelTreeDirtyRegion& dirty, uint32_t index);
+
+    SparseVoxelTreeNode combineNodes(const SparseVoxelTreeNode& node, const SparseVoxelTree& other, const SparseVoxelTreeNode& otherNode, int32_t scale,
+                                     SparseVoxelTreeCsgOp op, SparseVoxelTreeDirtyRegion& dirty);
+    void releaseSubtree(const SparseVoxelTreeNode& node, int32_t scale);
+    void shareArray(SparseVoxelTreeNode& node);
+    void addReference(const SparseVoxelTreeNode& node);
+    void dropReference(const SparseVoxelTreeNode& node);
+    void indexArrays();
+    void indexArray(const SparseVoxelTreeNode& node);
+    std::string arrayKey(const SparseVoxelTreeNode& node) const;
+    SparseVoxelTreeNode copySubtree(const SparseVoxelTree& other, const SparseVoxelTreeNode& otherNode, int32_t scale, SparseVoxelTreeDirtyRegion& dirty);
+    static SparseVoxelTreeNode csgChild(const SparseVoxelTree& tree, const SparseVoxelTreeNode& node, int32_t scale, int32_t index);
+    uint64_t tileMask(glm::ivec3 pos) const;
+    SparseVoxelTreeNode hollowNode(const SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 pos, std::vector<SparseVoxelTreeNode>& newNodePool,
+                                   std::vector<uint8_t>& newLeafData, std::vector<uint32_t>* sources) const;
+    SparseVoxelTreeNode deduplicate(const SparseVoxelTreeNode& node, std::vector<SparseVoxelTreeNode>& newNodePool, std::vector<uint8_t>& newLeafData,
+                                    std::unordered_map<std::string, uint32_t>& leafCache, std::unordered_map<std::string, uint32_t>& nodeCache) const;
+
+    template<int32_t Scale>
+    uint8_t atFixed(const SparseVoxelTreeNode& node, int32_t x, int32_t y, int32_t z) const;
+    template<int32_t Scale>
+    void fillVoxelMap(VoxelMap& voxelMap, const SparseVoxelTreeNode& node, glm::ivec3 pos) const;
+
+    static uint64_t PackBits64(const uint8_t* data);
+    static void LeftPack(uint8_t* data, uint64_t mask);
 
     void printTree(const SparseVoxelTreeNode& node, int32_t scale, glm::ivec3 pos, int depth) const;
 
@@ -82,6 +510,37 @@ private:
     std::vector<SparseVoxelTreeNode> nodePool;
     std::vector<uint8_t> leafData;
 
+    // Unused blocks of nodePool and leafData left behind by edits, indexed by their size
+    std::vector<uint32_t> freeNodeBlocks[65];
+    std::vector<uint32_t> freeLeafDataBlocks[65];
+
+    // Index of the child arrays of a deduplicated tree (DAG mode), see indexArrays: the reference count of
+    // every array that more than one node points at, and the offset of every array by its contents
+    bool sharesArrays = false;
+    std::unordered_map<uint32_t, uint32_t> nodeReferences;
+    std::unordered_map<uint32_t, uint32_t> leafDataReferences;
+    std::unordered_map<std::string, uint32_t> nodeArrays;
+    std::unordered_map<std::string, uint32_t> leafArrays;
+
+    // Optional level of detail table parallel to nodePool, see BuildLodTable. The voxel counts weigh the votes.
+    std::vector<uint8_t> nodeMaterials;
+    std::vector<uint64_t> nodeVoxelCounts;
+    uint8_t rootMaterial;
+
+    // Optional aggregate table parallel to nodePool, see BuildAggregateTable
+    std::vector<SparseVoxelTreeAggregate> nodeAggregates;
+    SparseVoxelTreeAggregate rootAggregate;
+
+    // Optional rank table parallel to nodePool, see BuildRankTable
+    std::vector<uint32_t> nodeRanks;
+    uint32_t rootRank;
+
+    int32_t rootScale;
+    glm::uvec3 dimensions;
+    size_t voxelCount;
+
+    SparseVoxelTreeOptions options;
+
     // AABB and Transform
     glm::vec3 AABBMin;
     glm::vec3 AABBMax;
@@ -89,13 +548,70 @@ private:
 
 private:
     friend VoxelTreeMemoryAllocator;
+    friend VoxelTreeAccessor;
+    friend CompactSparseVoxelTree;
 };
 
+template<int32_t RootScale>
+uint8_t SparseVoxelTree::At(int32_t x, int32_t y, int32_t z) const
+{
+    static_assert(RootScale >= MinRootScale && RootScale <= MaxRootScale && RootScale % 2 == 0, "Invalid root scale");
+    assert(RootScale == rootScale);
+
+    constexpr uint32_t extent = 1u << RootScale;
+    if (static_cast<uint32_t>(x) >= extent || static_cast<uint32_t>(y) >= extent || static_cast<uint32_t>(z) >= extent)
+    {
+        return 0;
+    }
+    return atFixed<RootScale>(root, x, y, z);
+}
+
+template<typename Func, int32_t Scale>
+decltype(auto) SparseVoxelTree::DispatchRootScale(Func&& func) const
+{
+    if constexpr (Scale < MaxRootScale)
+    {
+        if (rootScale != Scale)
+        {
+            return DispatchRootScale<Func, Scale + 2>(std::forward<Func>(func));
+        }
+    }
+    return func(std::integral_constant<int32_t, Scale>{});
+}
+
+// One level of At<RootScale>. Leaves are always at scale 2, so the recursion ends there at compile time.
+// The rank table is not used: it only replaces the popcount, and the constant level count matters more.
+template<int32_t Scale>
+[[gnu::always_inline]] inline uint8_t SparseVoxelTree::atFixed(const SparseVoxelTreeNode& node, int32_t x, int32_t y, int32_t z) const
+{
+    constexpr int32_t childScale = Scale - 2;
+    if (node.IsSolid)
+    {
+        return node.ChildPtr;
+    }
+
+    int32_t index = ((x >> childScale) & 3) | (((y >> childScale) & 3) << 2) | (((z >> childScale) & 3) << 4);
+    if (!(node.ChildMask & (1ull << index)))
+    {
+        return 0;
+    }
+
+    int32_t childPtr = node.ChildPtr + std::popcount(node.ChildMask & ((1ull << index) - 1));
+    if constexpr (childScale == 0)
+    {
+        return leafData[childPtr];
+    }
+    else
+    {
+        return atFixed<childScale>(nodePool[childPtr], x, y, z);
+    }
+}
+
 // GPU Sparse Voxel Tree
 
 struct GPUSparseVoxelTreeNode
 {
-    // PackedData[0]: Combines IsLeaf (1 bit) and ChildPtr (31 bits).
+    // PackedData[0]: Combines IsLeaf (bit 31), IsSolid (bit 30) and ChildPtr (lower 30 bits).
     // PackedData[1]: Lower 32 bits of ChildMask.
     // PackedData[2]: Upper 32 bits of ChildMask.
     // 12 bytes
@@ -122,8 +638,11 @@ struct GPUSparseVoxelTree
     // Offset into the LeafData buffer
     alignas(4) uint32_t LeafDataPtr; // 4 bytes
 
+    // Scale of the root node (the tree spans 2^RootScale voxels per axis)
+    alignas(4) uint32_t RootScale; // 4 bytes
+
     // Padding for 16-byte alignment of `bounds`
-    alignas(4) uint32_t _padding[3]; // 12 bytes
+    alignas(4) uint32_t _padding[2]; // 8 bytes
 
     // Axis-aligned bounding box of the tree
     alignas(16) GPUAABB Bounds; // 32 bytes
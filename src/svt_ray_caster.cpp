@@ -0,0 +1,617 @@
+#include "svt_ray_caster.h"
+#include "bit_pack.h"
+#include "hierarchical_dda.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__)
+#define SVT_RAY_CASTER_X86 1
+#endif
+
+namespace
+{
+    bool isLeaf(const GPUSparseVoxelTreeNode& node)
+    {
+        return (node.PackedData[0] & 0x80000000u) != 0u;
+    }
+
+    bool isSolid(const GPUSparseVoxelTreeNode& node)
+    {
+        return (node.PackedData[0] & 0x40000000u) != 0u;
+    }
+
+    uint32_t childPtr(const GPUSparseVoxelTreeNode& node)
+    {
+        return node.PackedData[0] & 0x3FFFFFFFu;
+    }
+
+    uint64_t childMask(const GPUSparseVoxelTreeNode& node)
+    {
+        return static_cast<uint64_t>(node.PackedData[2]) << 32 | node.PackedData[1];
+    }
+
+    bool isBitSet(uint64_t mask, uint32_t bitIndex)
+    {
+        return (mask >> bitIndex) & 1u;
+    }
+
+    uint32_t popcnt64Below(uint64_t mask, uint32_t bitIndex)
+    {
+        return std::popcount(mask & ((1ull << bitIndex) - 1));
+    }
+}
+
+SvtRayCaster::SvtRayCaster(const VoxelTreeMemoryAllocator& allocator, const std::vector<glm::vec4>& palette)
+    : trees(allocator.GetTreeBufferData()),
+      nodePool(allocator.GetNodePoolBufferData()),
+      leafData(allocator.GetLeafDataBufferData()),
+      nodeMaterials(allocator.GetNodeMaterialBufferData()),
+      palette(palette)
+{
+}
+
+SvtView SvtRayCaster::MakeView(Camera camera, uint32_t width, uint32_t height)
+{
+    float deg2rad = 3.1415926535897931 / 180.0;
+    float planeHeight = camera.NearClipPlane * tan(camera.Fov * 0.5f * deg2rad) * 2;
+    float planeWidth = planeHeight * camera.Aspect;
+
+    SvtView view;
+    view.ScreenSize = glm::vec2(width, height);
+    view.ViewParams = glm::vec3(planeWidth, planeHeight, camera.NearClipPlane);
+    view.CamWorldMatrix = camera.GetCameraToWorldMatrix();
+    return view;
+}
+
+SvtRay SvtRayCaster::GetPrimaryRay(const SvtView& view, uint32_t x, uint32_t y) const
+{
+    glm::vec2 texCoords = glm::vec2(static_cast<float>(x) / view.ScreenSize.x, static_cast<float>(y) / view.ScreenSize.y);
+    glm::vec3 viewPointLocal = glm::vec3(texCoords - 0.5f, 1.0f) * view.ViewParams;
+    glm::vec3 viewPoint = glm::vec3(view.CamWorldMatrix * glm::vec4(viewPointLocal, 1.0f));
+
+    SvtRay ray;
+    ray.Origin = glm::vec3(view.CamWorldMatrix[3]);
+    ray.Direction = glm::normalize(viewPoint - ray.Origin);
+    return ray;
+}
+
+glm::vec3 SvtRayCaster::GetSkyColor(glm::vec3 direction) const
+{
+    return glm::vec3(0.25f, 0.25f, 0.4f);
+}
+
+glm::vec3 SvtRayCaster::paletteColor(uint32_t material) const
+{
+    // Reads past the end of a shader storage buffer return zero
+    return material < palette.size() ? glm::vec3(palette[material]) : glm::vec3(0.0f);
+}
+
+SvtHit SvtRayCaster::makeHit(const SvtRay& ray, float t, glm::ivec3 voxel, glm::vec3 normal, uint32_t material, uint32_t steps) const
+{
+    SvtHit hit;
+    hit.Hit = true;
+    hit.Position = ray.Origin + t * ray.Direction;
+    hit.Normal = normal;
+    hit.Voxel = voxel;
+    hit.Distance = t;
+    hit.Material = material;
+    hit.Color = paletteColor(material);
+    hit.Steps = steps;
+    return hit;
+}
+
+bool SvtRayCaster::beginRay(const SvtRay& ray, const GPUSparseVoxelTree& tree, RayStart& start) const
+{
+    // Intersect the tree's bounds
+    glm::vec3 boundsMin = glm::vec3(tree.Bounds.Min);
+    glm::vec3 boundsMax = glm::vec3(tree.Bounds.Max);
+    glm::vec3 invDir = 1.0f / ray.Direction;
+    glm::vec3 t1 = (boundsMin - ray.Origin) * invDir;
+    glm::vec3 t2 = (boundsMax - ray.Origin) * invDir;
+    glm::vec3 tMinVec = glm::min(t1, t2);
+    glm::vec3 tMaxVec = glm::max(t1, t2);
+    float tEntry = std::max(std::max(tMinVec.x, tMinVec.y), tMinVec.z);
+    float tExit = std::min(std::min(tMaxVec.x, tMaxVec.y), tMaxVec.z);
+    if (tExit < 0.0f || tEntry > tExit)
+    {
+        return false;
+    }
+
+    start.T = tEntry > 0.0f ? tEntry : 0.0f;
+    start.TExit = tExit;
+
+    // The shader has no normals; they come from the face the ray last entered through
+    start.Normal = glm::vec3(0.0f);
+    if (tEntry > 0.0f)
+    {
+        int32_t axis = tEntry == tMinVec.x ? 0 : tEntry == tMinVec.y ? 1 : 2;
+        start.Normal[axis] = ray.Direction[axis] > 0.0f ? -1.0f : 1.0f;
+    }
+
+    glm::vec3 rayPos = ray.Origin + start.T * ray.Direction;
+    start.Voxel = glm::clamp(glm::ivec3(glm::floor(rayPos)), glm::ivec3(boundsMin), glm::ivec3(boundsMax) - 1);
+    return true;
+}
+
+SvtHit SvtRayCaster::RayCast(const SvtRay& ray, const SvtView& view, uint32_t treeIndex) const
+{
+    const GPUSparseVoxelTree& tree = trees[treeIndex];
+
+    RayStart start;
+    if (!beginRay(ray, tree, start))
+    {
+        return SvtHit();
+    }
+    return traverse(ray, view, tree, start, 0);
+}
+
+// Node access for TraverseHierarchicalDda, with the level of detail cut-off of the shader
+struct SvtRayCaster::TraversalSource
+{
+    using Node = GPUSparseVoxelTreeNode;
+    using Value = uint32_t;
+    static constexpr int32_t MaxDepth = SparseVoxelTree::MaxRootScale / 2;
+    static constexpr bool MonotonicSteps = false;
+    static constexpr bool TrackNormals = true;
+
+    const SvtRayCaster& caster;
+    const SvtView& view;
+    const GPUSparseVoxelTree& tree;
+    float pixelSize;
+    int32_t depthLimit;
+
+    Node Root() const { return tree.Root; }
+
+    void BeginStep(float t)
+    {
+        depthLimit = view.MaxDepth;
+        float footprint = t * pixelSize * view.LodBias;
+        if (footprint > 1.0f)
+        {
+            depthLimit = std::min(depthLimit, (static_cast<int32_t>(tree.RootScale) - static_cast<int32_t>(std::log2(footprint))) / 2);
+        }
+    }
+
+    HierarchicalDdaStep Visit(const Node& node, int32_t depth, glm::ivec3 localCoord, int32_t& shift, Node& child, uint32_t& material) const
+    {
+        if (isSolid(node))
+        {
+            material = childPtr(node);
+            return HierarchicalDdaStep::Hit;
+        }
+
+        uint32_t cellIndex = ((localCoord.x >> shift) & 3) + ((localCoord.y >> shift) & 3) * 4 + ((localCoord.z >> shift) & 3) * 16;
+        if (!isBitSet(childMask(node), cellIndex))
+        {
+            return HierarchicalDdaStep::Empty;
+        }
+
+        if (isLeaf(node))
+        {
+            material = caster.leafData[tree.LeafDataPtr + childPtr(node) + popcnt64Below(childMask(node), cellIndex)];
+            return HierarchicalDdaStep::Hit;
+        }
+
+        // Past the depth limit the child is treated as solid
+        uint32_t childIndex = tree.NodePoolPtr + childPtr(node) + popcnt64Below(childMask(node), cellIndex);
+        if (depth + 1 > depthLimit)
+        {
+            material = caster.nodeMaterials[childIndex];
+            return HierarchicalDdaStep::Hit;
+        }
+
+        child = caster.nodePool[childIndex];
+        return HierarchicalDdaStep::Descend;
+    }
+};
+
+SvtHit SvtRayCaster::traverse(const SvtRay& ray, const SvtView& view, const GPUSparseVoxelTree& tree, const RayStart& start, uint32_t firstStep) const
+{
+    HierarchicalDdaRay ddaRay;
+    ddaRay.Origin = ray.Origin;
+    ddaRay.Direction = ray.Direction;
+    ddaRay.T = start.T;
+    ddaRay.TExit = start.TExit;
+    ddaRay.Voxel = start.Voxel;
+    ddaRay.Normal = glm::ivec3(start.Normal);
+    ddaRay.FirstStep = firstStep;
+    ddaRay.MaxSteps = MaxSteps;
+
+    float pixelSize = view.ViewParams.y / (view.ViewParams.z * view.ScreenSize.y);
+    TraversalSource source{ *this, view, tree, pixelSize, 0 };
+    HierarchicalDdaHit<uint32_t> hit = TraverseHierarchicalDda(source, ddaRay, static_cast<int32_t>(tree.RootScale), glm::ivec3(glm::vec3(tree.Bounds.Min)));
+    if (hit.Hit)
+    {
+        return makeHit(ray, hit.Distance, hit.Voxel, glm::vec3(hit.Normal), hit.Material, hit.Steps);
+    }
+
+    SvtHit miss;
+    miss.Steps = hit.Steps;
+    return miss;
+}
+
+// Packet traversal for RayCastPacket. The lanes of a packet are written with GCC vector extensions, so the
+// same code compiles to SSE2 for 4 lanes and, inlined into an AVX2 function, to AVX2 for 8. Every lane does
+// exactly the float and integer operations of SvtRayCaster::traverse, so it visits the same cells and ends
+// with the same hit.
+template<int32_t N>
+struct SvtLanes
+{
+    typedef float Float __attribute__((vector_size(4 * N)));
+    typedef int32_t Int __attribute__((vector_size(4 * N)));
+};
+
+namespace
+{
+    template<typename Int>
+    [[gnu::always_inline]] inline int32_t firstActiveLane(const Int& mask)
+    {
+        for (int32_t lane = 0; lane < static_cast<int32_t>(sizeof(Int) / 4); ++lane)
+        {
+            if (mask[lane])
+            {
+                return lane;
+            }
+        }
+        return -1;
+    }
+
+    template<typename Int>
+    [[gnu::always_inline]] inline bool anyLane(const Int& mask)
+    {
+        int32_t bits = 0;
+        for (int32_t lane = 0; lane < static_cast<int32_t>(sizeof(Int) / 4); ++lane)
+        {
+            bits |= mask[lane];
+        }
+        return bits != 0;
+    }
+}
+
+struct SvtPacketTraversal
+{
+    template<int32_t N>
+    [[gnu::always_inline]] static inline void cast(const SvtRayCaster& caster, const SvtRay* rays, SvtHit* hits, uint32_t count, const SvtView& view, const GPUSparseVoxelTree& tree)
+    {
+        using Float = typename SvtLanes<N>::Float;
+        using Int = typename SvtLanes<N>::Int;
+
+        // Lane state, one vector per component
+        Float ox, oy, oz, dx, dy, dz, ix, iy, iz, t, tExit, nx, ny, nz;
+        Int px, py, pz;
+        Int steps = Int{};
+        Int active = Int{};
+        for (int32_t lane = 0; lane < N; ++lane)
+        {
+            SvtRayCaster::RayStart start;
+            if (static_cast<uint32_t>(lane) < count && caster.beginRay(rays[lane], tree, start))
+            {
+                const SvtRay& ray = rays[lane];
+                glm::vec3 invDir = 1.0f / ray.Direction;
+                ox[lane] = ray.Origin.x; oy[lane] = ray.Origin.y; oz[lane] = ray.Origin.z;
+                dx[lane] = ray.Direction.x; dy[lane] = ray.Direction.y; dz[lane] = ray.Direction.z;
+                ix[lane] = invDir.x; iy[lane] = invDir.y; iz[lane] = invDir.z;
+                t[lane] = start.T;
+                tExit[lane] = start.TExit;
+                nx[lane] = start.Normal.x; ny[lane] = start.Normal.y; nz[lane] = start.Normal.z;
+                px[lane] = start.Voxel.x; py[lane] = start.Voxel.y; pz[lane] = start.Voxel.z;
+                active[lane] = -1;
+            }
+            else
+            {
+                // Unused lanes get harmless values, their results are never read
+                ox[lane] = oy[lane] = oz[lane] = 0.0f;
+                dx[lane] = dy[lane] = dz[lane] = 1.0f;
+                ix[lane] = iy[lane] = iz[lane] = 1.0f;
+                t[lane] = tExit[lane] = 0.0f;
+                nx[lane] = ny[lane] = nz[lane] = 0.0f;
+                px[lane] = py[lane] = pz[lane] = 0;
+                if (static_cast<uint32_t>(lane) < count)
+                {
+                    hits[lane] = SvtHit();
+                }
+            }
+        }
+
+        auto finishHit = [&](int32_t lane, uint32_t material)
+        {
+            glm::ivec3 voxel = glm::ivec3(px[lane], py[lane], pz[lane]);
+            glm::vec3 normal = glm::vec3(nx[lane], ny[lane], nz[lane]);
+            hits[lane] = caster.makeHit(rays[lane], t[lane], voxel, normal, material, steps[lane] + 1);
+            active[lane] = 0;
+        };
+        auto finishMiss = [&](int32_t lane, uint32_t stepCount)
+        {
+            hits[lane] = SvtHit();
+            hits[lane].Steps = stepCount;
+            active[lane] = 0;
+        };
+        auto finishAlone = [&](int32_t lane)
+        {
+            SvtRayCaster::RayStart start;
+            start.T = t[lane];
+            start.TExit = tExit[lane];
+            start.Voxel = glm::ivec3(px[lane], py[lane], pz[lane]);
+            start.Normal = glm::vec3(nx[lane], ny[lane], nz[lane]);
+            hits[lane] = caster.traverse(rays[lane], view, tree, start, steps[lane]);
+            active[lane] = 0;
+        };
+
+        int32_t rootScale = static_cast<int32_t>(tree.RootScale);
+        glm::ivec3 rootOrigin = glm::ivec3(glm::vec3(tree.Bounds.Min));
+        glm::ivec3 rootEnd = rootOrigin + glm::ivec3(1 << rootScale);
+
+        // Nodes on the path from the root to the node the packet is in, and a voxel in that node
+        GPUSparseVoxelTreeNode stack[SparseVoxelTree::MaxRootScale / 2 + 1];
+        stack[0] = tree.Root;
+        int32_t depth = 0;
+        glm::ivec3 pathPos = glm::ivec3(0);
+        int32_t first = firstActiveLane(active);
+        if (first >= 0)
+        {
+            pathPos = glm::ivec3(px[first], py[first], pz[first]);
+        }
+
+        while ((first = firstActiveLane(active)) >= 0)
+        {
+            // Ascend to the deepest node on the stack that holds the voxels of all active lanes
+            Int diffs = ((px ^ pathPos.x) | (py ^ pathPos.y) | (pz ^ pathPos.z)) & active;
+            uint32_t diff = 0;
+            for (int32_t lane = 0; lane < N; ++lane)
+            {
+                diff |= static_cast<uint32_t>(diffs[lane]);
+            }
+            int32_t commonScale = (std::bit_width(diff) + 1) & ~1;
+            depth = std::min(depth, (rootScale - commonScale) / 2);
+            pathPos = glm::ivec3(px[first], py[first], pz[first]);
+
+            Int lx = px - rootOrigin.x;
+            Int ly = py - rootOrigin.y;
+            Int lz = pz - rootOrigin.z;
+            GPUSparseVoxelTreeNode node = stack[depth];
+            int32_t shift = rootScale - 2 * depth - 2;
+
+            // Descend together while all lanes are in the same cell
+            while (true)
+            {
+                if (isSolid(node))
+                {
+                    for (int32_t lane = 0; lane < N; ++lane)
+                    {
+                        if (active[lane]) finishHit(lane, childPtr(node));
+                    }
+                    break;
+                }
+
+                Int cell = ((lx >> shift) & 3) | (((ly >> shift) & 3) << 2) | (((lz >> shift) & 3) << 4);
+                uint64_t mask = childMask(node);
+                uint32_t firstCell = static_cast<uint32_t>(cell[first]);
+
+                if (!anyLane((cell != static_cast<int32_t>(firstCell)) & active))
+                {
+                    if (!isBitSet(mask, firstCell))
+                    {
+                        break;
+                    }
+
+                    uint32_t slot = popcnt64Below(mask, firstCell);
+                    if (isLeaf(node))
+                    {
+                        uint32_t material = caster.leafData[tree.LeafDataPtr + childPtr(node) + slot];
+                        for (int32_t lane = 0; lane < N; ++lane)
+                        {
+                            if (active[lane]) finishHit(lane, material);
+                        }
+                        break;
+                    }
+
+                    uint32_t childIndex = tree.NodePoolPtr + childPtr(node) + slot;
+                    if (depth + 1 > view.MaxDepth)
+                    {
+                        for (int32_t lane = 0; lane < N; ++lane)
+                        {
+                            if (active[lane]) finishHit(lane, caster.nodeMaterials[childIndex]);
+                        }
+                        break;
+                    }
+
+                    node = caster.nodePool[childIndex];
+                    stack[++depth] = node;
+                    shift -= 2;
+                    continue;
+                }
+
+                // The lanes are in different cells of this node. Those in empty cells step on together, the
+                // others end here or finish on their own.
+                for (int32_t lane = 0; lane < N; ++lane)
+                {
+                    if (!active[lane] || !isBitSet(mask, cell[lane]))
+                    {
+                        continue;
+                    }
+
+                    uint32_t slot = popcnt64Below(mask, cell[lane]);
+                    if (isLeaf(node))
+                    {
+                        finishHit(lane, caster.leafData[tree.LeafDataPtr + childPtr(node) + slot]);
+                    }
+                    else if (depth + 1 > view.MaxDepth)
+                    {
+                        finishHit(lane, caster.nodeMaterials[tree.NodePoolPtr + childPtr(node) + slot]);
+                    }
+                    else
+                    {
+                        finishAlone(lane);
+                    }
+                }
+                break;
+            }
+
+            if (!anyLane(active))
+            {
+                break;
+            }
+
+            // Step every lane across its empty cell, 2^shift voxels wide
+            Int minX = rootOrigin.x + ((lx >> shift) << shift);
+            Int minY = rootOrigin.y + ((ly >> shift) << shift);
+            Int minZ = rootOrigin.z + ((lz >> shift) << shift);
+            Int maxX = minX + (1 << shift);
+            Int maxY = minY + (1 << shift);
+            Int maxZ = minZ + (1 << shift);
+
+            Float far = Float{} + std::numeric_limits<float>::infinity();
+            Float zero = Float{};
+            Float sx = dx > zero ? (__builtin_convertvector(maxX, Float) - ox) * ix : (dx < zero ? (__builtin_convertvector(minX, Float) - ox) * ix : far);
+            Float sy = dy > zero ? (__builtin_convertvector(maxY, Float) - oy) * iy : (dy < zero ? (__builtin_convertvector(minY, Float) - oy) * iy : far);
+            Float sz = dz > zero ? (__builtin_convertvector(maxZ, Float) - oz) * iz : (dz < zero ? (__builtin_convertvector(minZ, Float) - oz) * iz : far);
+            // Same results as std::min and std::max in traverse
+            Float syz = sz < sy ? sz : sy;
+            Float tNext = syz < sx ? syz : sx;
+
+            Int past = (tNext > tExit) & active;
+            for (int32_t lane = 0; lane < N; ++lane)
+            {
+                if (past[lane]) finishMiss(lane, steps[lane] + 1);
+            }
+
+            t = active ? (t < tNext ? tNext : t) : t;
+            Float rx = ox + t * dx;
+            Float ry = oy + t * dy;
+            Float rz = oz + t * dz;
+
+            // Floor by truncating and correcting the lanes that were rounded up
+            Int fx = __builtin_convertvector(rx, Int);
+            Int fy = __builtin_convertvector(ry, Int);
+            Int fz = __builtin_convertvector(rz, Int);
+            fx += __builtin_convertvector(fx, Float) > rx;
+            fy += __builtin_convertvector(fy, Float) > ry;
+            fz += __builtin_convertvector(fz, Float) > rz;
+            fx = fx < minX ? minX : fx;
+            fy = fy < minY ? minY : fy;
+            fz = fz < minZ ? minZ : fz;
+            fx = fx > maxX - 1 ? maxX - 1 : fx;
+            fy = fy > maxY - 1 ? maxY - 1 : fy;
+            fz = fz > maxZ - 1 ? maxZ - 1 : fz;
+
+            Int exitX = sx == tNext;
+            Int exitY = sy == tNext;
+            Int exitZ = sz == tNext;
+            fx = exitX ? (dx > zero ? maxX : minX - 1) : fx;
+            fy = exitY ? (dy > zero ? maxY : minY - 1) : fy;
+            fz = exitZ ? (dz > zero ? maxZ : minZ - 1) : fz;
+            px = active ? fx : px;
+            py = active ? fy : py;
+            pz = active ? fz : pz;
+
+            Float one = zero + 1.0f;
+            nx = active ? (exitX ? (dx > zero ? -one : one) : zero) : nx;
+            ny = active ? ((exitY & ~exitX) ? (dy > zero ? -one : one) : zero) : ny;
+            nz = active ? ((exitZ & ~exitX & ~exitY) ? (dz > zero ? -one : one) : zero) : nz;
+
+            Int outside = (px < rootOrigin.x) | (py < rootOrigin.y) | (pz < rootOrigin.z) | (px >= rootEnd.x) | (py >= rootEnd.y) | (pz >= rootEnd.z);
+            steps -= active;
+            for (int32_t lane = 0; lane < N; ++lane)
+            {
+                if (!active[lane])
+                {
+                    continue;
+                }
+                if (outside[lane])
+                {
+                    finishMiss(lane, steps[lane]);
+                }
+                else if (static_cast<uint32_t>(steps[lane]) >= SvtRayCaster::MaxSteps)
+                {
+                    finishMiss(lane, SvtRayCaster::MaxSteps);
+                }
+            }
+        }
+    }
+
+    static void cast4(const SvtRayCaster& caster, const SvtRay* rays, SvtHit* hits, uint32_t count, const SvtView& view, const GPUSparseVoxelTree& tree)
+    {
+        cast<4>(caster, rays, hits, count, view, tree);
+    }
+
+#ifdef SVT_RAY_CASTER_X86
+    __attribute__((target("avx2")))
+    static void cast8(const SvtRayCaster& caster, const SvtRay* rays, SvtHit* hits, uint32_t count, const SvtView& view, const GPUSparseVoxelTree& tree)
+    {
+        cast<8>(caster, rays, hits, count, view, tree);
+    }
+#endif
+};
+
+uint32_t SvtRayCaster::GetPacketSize()
+{
+#ifdef SVT_RAY_CASTER_X86
+    static const uint32_t size = BitPack::IsAVX2Supported() ? 8 : 4;
+    return size;
+#else
+    return 4;
+#endif
+}
+
+void SvtRayCaster::RayCastPacket(std::span<const SvtRay> rays, std::span<SvtHit> hits, const SvtView& view, uint32_t treeIndex) const
+{
+    assert(rays.size() == hits.size());
+    const GPUSparseVoxelTree& tree = trees[treeIndex];
+
+    // The level of detail cutoff depends on each ray's distance, so the rays cannot share their descent
+    if (view.LodBias != 0.0f)
+    {
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            hits[i] = RayCast(rays[i], view, treeIndex);
+        }
+        return;
+    }
+
+    uint32_t packetSize = GetPacketSize();
+    for (size_t i = 0; i < rays.size(); i += packetSize)
+    {
+        uint32_t count = static_cast<uint32_t>(std::min<size_t>(packetSize, rays.size() - i));
+#ifdef SVT_RAY_CASTER_X86
+        if (packetSize == 8)
+        {
+            SvtPacketTraversal::cast8(*this, &rays[i], &hits[i], count, view, tree);
+            continue;
+        }
+#endif
+        SvtPacketTraversal::cast4(*this, &rays[i], &hits[i], count, view, tree);
+    }
+}
+
+SvtRenderStats SvtRayCaster::Render(const SvtView& view, std::vector<glm::vec4>& image, uint32_t treeIndex) const
+{
+    uint32_t width = static_cast<uint32_t>(view.ScreenSize.x);
+    uint32_t height = static_cast<uint32_t>(view.ScreenSize.y);
+    image.resize(static_cast<size_t>(width) * height);
+
+    SvtRenderStats stats;
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            SvtRay ray = GetPrimaryRay(view, x, y);
+            SvtHit hit = RayCast(ray, view, treeIndex);
+
+            glm::vec3 albedo = hit.Hit ? hit.Color : GetSkyColor(ray.Direction);
+            image[static_cast<size_t>(y) * width + x] = glm::vec4(albedo, 1.0f);
+
+            stats.Hits += hit.Hit;
+            stats.Steps += hit.Steps;
+        }
+    }
+
+    stats.Rays = static_cast<uint64_t>(width) * height;
+    stats.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "camera.h"
+#include "voxel_tree_memory_allocator.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Ray through the scene, same as Ray in default_compute.glsl
+struct SvtRay
+{
+    glm::vec3 Origin;
+    glm::vec3 Direction;
+};
+
+// Result of SvtRayCaster::RayCast. Everything but Steps is only valid when Hit is set.
+struct SvtHit
+{
+    bool Hit = false;
+    glm::vec3 Position = glm::vec3(0.0f); // Where the ray entered the hit voxel (or node)
+    glm::vec3 Normal = glm::vec3(0.0f);   // Axis of the last cell boundary crossed, zero if the ray started inside it
+    glm::ivec3 Voxel = glm::ivec3(0);     // Voxel the ray was in, inside the hit node for solid and level of detail hits
+    float Distance = 0.0f;
+    uint32_t Material = 0;
+    glm::vec3 Color = glm::vec3(0.0f);
+    uint32_t Steps = 0;                   // Iterations of the traversal loop
+};
+
+// The uniforms of default_compute.glsl
+struct SvtView
+{
+    glm::vec2 ScreenSize;
+    glm::vec3 ViewParams; // planeWidth, planeHeight, near clip plane
+    glm::mat4 CamWorldMatrix;
+    int32_t MaxDepth = SparseVoxelTree::MaxRootScale / 2; // At least 1, see MaxDepth in default_compute.glsl
+    float LodBias = 0.0f;
+};
+
+struct SvtRenderStats
+{
+    uint64_t Rays = 0;
+    uint64_t Hits = 0;
+    uint64_t Steps = 0;
+    double Seconds = 0.0;
+
+    double GetRaysPerSecond() const { return Seconds > 0.0 ? Rays / Seconds : 0.0; }
+};
+
+// CPU port of the ray traversal in default_compute.glsl, reading the same tree, node pool, leaf data and node
+// material buffers that VoxelTreeMemoryAllocator uploads. Gives a ground truth for the shader and a CPU
+// throughput baseline on machines without a GPU; any change to RayCast or GetPrimaryRay in the shader has to
+// be made here as well.
+//
+// The buffers are copied, so the caster does not follow a later Allocate of the allocator.
+class SvtRayCaster
+{
+public:
+    // Same cap on traversal steps as the shader
+    static constexpr uint32_t MaxSteps = 256;
+
+    // `palette` is the palette buffer of the shader, indexed by material
+    SvtRayCaster(const VoxelTreeMemoryAllocator& allocator, const std::vector<glm::vec4>& palette);
+
+    // Uniforms for rendering from `camera` into a `width` x `height` image, as set up by main
+    static SvtView MakeView(Camera camera, uint32_t width, uint32_t height);
+
+    SvtRay GetPrimaryRay(const SvtView& view, uint32_t x, uint32_t y) const;
+    SvtHit RayCast(const SvtRay& ray, const SvtView& view, uint32_t treeIndex = 0) const;
+
+    // Casts `rays` into `hits` (same size) in packets of GetPacketSize() rays, with the same result as RayCast
+    // for every ray. The rays of a packet share the node fetches and mask tests of a step as long as they are
+    // in the same node, and each crosses its own empty cell with SIMD arithmetic. Once they need different
+    // children, the rays that diverged finish on their own. Order the rays so neighbouring ones are close,
+    // e.g. 4x2 or 2x2 pixel blocks. With a nonzero LodBias every ray is cast on its own.
+    void RayCastPacket(std::span<const SvtRay> rays, std::span<SvtHit> hits, const SvtView& view, uint32_t treeIndex = 0) const;
+
+    // 8 rays with AVX2, else 4
+    static uint32_t GetPacketSize();
+
+    glm::vec3 GetSkyColor(glm::vec3 direction) const;
+
+    // Renders a whole frame of `treeIndex` into `image` (row-major, row 0 first, like imgOutput), resizing it
+    // to the screen size of `view`.
+    SvtRenderStats Render(const SvtView& view, std::vector<glm::vec4>& image, uint32_t treeIndex = 0) const;
+
+    size_t GetTreeCount() const { return trees.size(); }
+
+private:
+    friend struct SvtPacketTraversal;
+
+    // Where a ray enters a tree's bounds
+    struct RayStart
+    {
+        float T;
+        float TExit;
+        glm::ivec3 Voxel;
+        glm::vec3 Normal;
+    };
+
+    std::vector<GPUSparseVoxelTree> trees;
+    std::vector<GPUSparseVoxelTreeNode> nodePool;
+    std::vector<uint32_t> leafData;
+    std::vector<uint32_t> nodeMaterials;
+    std::vector<glm::vec4> palette;
+
+    glm::vec3 paletteColor(uint32_t material) const;
+    SvtHit makeHit(const SvtRay& ray, float t, glm::ivec3 voxel, glm::vec3 normal, uint32_t material, uint32_t steps) const;
+
+    // Returns false if the ray misses the tree's bounds
+    bool beginRay(const SvtRay& ray, const GPUSparseVoxelTree& tree, RayStart& start) const;
+
+    // Node access for the hierarchical DDA of traverse
+    struct TraversalSource;
+
+    // Traverses the tree from `start`, counting steps from `firstStep`
+    SvtHit traverse(const SvtRay& ray, const SvtView& view, const GPUSparseVoxelTree& tree, const RayStart& start, uint32_t firstStep) const;
+};
@@ -5,7 +5,7 @@
 #define OGT_VOX_IMPLEMENTATION
 #include "ogt/vox.h"
 
-VoxelMap VoxLoader::load(const char* file_path)
+static const ogt_vox_scene* readScene(const char* file_path)
 {
     std::ifstream file(file_path, std::ios::binary | std::ios::ate);
     if (!file)
@@ -28,31 +28,76 @@ VoxelMap VoxLoader::load(const char* file_path)
         throw std::runtime_error("Failed to parse .vox file.");
     }
 
-    // Assume we're only interested in the first model.
-    const ogt_vox_model* model = scene->models[0];
-    VoxelMap voxel_map;
-    voxel_map.size_x = model->size_x;
-    voxel_map.size_y = model->size_y;
-    voxel_map.size_z = model->size_z;
-    voxel_map.voxels.resize(voxel_map.size_x * voxel_map.size_y * voxel_map.size_z);
-    std::copy(model->voxel_data, model->voxel_data + voxel_map.voxels.size(), voxel_map.voxels.begin());
+    return scene;
+}
 
+static void readMaterials(const ogt_vox_scene* scene, std::vector<ogt_vox_matl>& material_map, std::vector<ogt_vox_rgba>& palette)
+{
     // Initialize the material map.
     // The ogt_vox_scene contains a 'materials' member of type ogt_vox_matl_array.
-    voxel_map.material_map.resize(256);
+    material_map.resize(256);
     for (uint32_t i = 0; i < 256; ++i)
     {
-        voxel_map.material_map[i] = scene->materials.matl[i];
+        material_map[i] = scene->materials.matl[i];
     }
 
     // Initialize the color palette.
     // The ogt_vox_scene has a palette member of type ogt_vox_palette.
-    voxel_map.palette.resize(256);
+    palette.resize(256);
     for (uint32_t i = 0; i < 256; ++i)
     {
-        voxel_map.palette[i] = scene->palette.color[i];
+        palette[i] = scene->palette.color[i];
     }
+}
+
+VoxelMap VoxLoader::load(const char* file_path)
+{
+    const ogt_vox_scene* scene = readScene(file_path);
+
+    // Assume we're only interested in the first model.
+    const ogt_vox_model* model = scene->models[0];
+    VoxelMap voxel_map;
+    voxel_map.size_x = model->size_x;
+    voxel_map.size_y = model->size_y;
+    voxel_map.size_z = model->size_z;
+    voxel_map.voxels.resize(voxel_map.size_x * voxel_map.size_y * voxel_map.size_z);
+    std::copy(model->voxel_data, model->voxel_data + voxel_map.voxels.size(), voxel_map.voxels.begin());
+
+    readMaterials(scene, voxel_map.material_map, voxel_map.palette);
 
     ogt_vox_destroy_scene(scene);
     return voxel_map;
 }
+
+SparseVoxelList VoxLoader::loadSparse(const char* file_path)
+{
+    const ogt_vox_scene* scene = readScene(file_path);
+
+    // Assume we're only interested in the first model.
+    const ogt_vox_model* model = scene->models[0];
+    SparseVoxelList voxel_list;
+    voxel_list.size_x = model->size_x;
+    voxel_list.size_y = model->size_y;
+    voxel_list.size_z = model->size_z;
+
+    // Only keep the non-empty voxels of the model.
+    const uint8_t* voxel = model->voxel_data;
+    for (uint32_t z = 0; z < model->size_z; ++z)
+    {
+        for (uint32_t y = 0; y < model->size_y; ++y)
+        {
+            for (uint32_t x = 0; x < model->size_x; ++x, ++voxel)
+            {
+                if (*voxel != 0)
+                {
+                    voxel_list.voxels.push_back({ x, y, z, *voxel });
+                }
+            }
+        }
+    }
+
+    readMaterials(scene, voxel_list.material_map, voxel_list.palette);
+
+    ogt_vox_destroy_scene(scene);
+    return voxel_list;
+}
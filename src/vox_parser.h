@@ -6,4 +6,7 @@ class VoxLoader
 {
 public:
     static VoxelMap load(const char* file_path);
+
+    // Loads the first model as a list of its non-empty voxels, without building a dense voxel map.
+    static SparseVoxelList loadSparse(const char* file_path);
 };
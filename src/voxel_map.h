@@ -27,5 +27,27 @@ struct VoxelMap
     float getIOR(uint8_t index) const;
 };
 
+// A single non-empty voxel of a sparse voxel list.
+struct SparseVoxel
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+    uint8_t material;
+};
+
+// A volume stored as a list of its non-empty voxels instead of a dense grid.
+struct SparseVoxelList
+{
+    std::vector<SparseVoxel> voxels;
+    uint32_t size_x;
+    uint32_t size_y;
+    uint32_t size_z;
+
+    // Same as VoxelMap::material_map and VoxelMap::palette.
+    std::vector<ogt_vox_matl> material_map;
+    std::vector<ogt_vox_rgba> palette;
+};
+
 void PrintVoxelMap(const VoxelMap& voxelMap, const std::string& name);
 void CompareVoxelMaps(const VoxelMap& original, const VoxelMap& reconstructed);
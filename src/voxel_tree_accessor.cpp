@@ -0,0 +1,61 @@
+#include "voxel_tree_accessor.h"
+#include <algorithm>
+#include <bit>
+
+VoxelTreeAccessor::VoxelTreeAccessor(const SparseVoxelTree& tree)
+    : tree(tree)
+{
+    Reset();
+}
+
+void VoxelTreeAccessor::Reset()
+{
+    nodes[0] = &tree.root;
+    cachedDepth = 0;
+    cachedPos = glm::ivec3(0, 0, 0);
+}
+
+uint8_t VoxelTreeAccessor::At(int32_t x, int32_t y, int32_t z)
+{
+    // Coordinates outside of the root region are always empty
+    uint32_t extent = 1u << tree.rootScale;
+    if (static_cast<uint32_t>(x) >= extent || static_cast<uint32_t>(y) >= extent || static_cast<uint32_t>(z) >= extent)
+    {
+        return 0;
+    }
+
+    // The highest differing coordinate bit tells which cached node still contains the position: a node at
+    // scale s holds every position that agrees with the cached one on all bits at or above s.
+    uint32_t diff = static_cast<uint32_t>((x ^ cachedPos.x) | (y ^ cachedPos.y) | (z ^ cachedPos.z));
+    int32_t commonScale = std::max<int32_t>((std::bit_width(diff) + 1) & ~1, 2);
+    int32_t depth = std::min((tree.rootScale - commonScale) / 2, cachedDepth);
+
+    cachedPos = glm::ivec3(x, y, z);
+
+    const SparseVoxelTreeNode* node = nodes[depth];
+    for (int32_t scale = tree.rootScale - 2 * depth - 2; ; scale -= 2)
+    {
+        if (node->IsSolid)
+        {
+            cachedDepth = depth;
+            return node->ChildPtr;
+        }
+
+        int32_t index = ((x >> scale) & 3) | (((y >> scale) & 3) << 2) | (((z >> scale) & 3) << 4);
+        if (!(node->ChildMask & (1ull << index)))
+        {
+            cachedDepth = depth;
+            return 0;
+        }
+
+        int32_t childPtr = node->ChildPtr + tree.childSlot(*node, index);
+        if (node->IsLeaf)
+        {
+            cachedDepth = depth;
+            return tree.leafData[childPtr];
+        }
+
+        node = &tree.nodePool[childPtr];
+        nodes[++depth] = node;
+    }
+}
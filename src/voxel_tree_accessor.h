@@ -0,0 +1,32 @@
+#pragma once
+
+#include "sparse_voxel_tree.h"
+
+// Looks up voxels of a SparseVoxelTree while caching the path to the last visited leaf.
+//
+// Consecutive lookups that fall in the same 4x4x4 leaf are answered with a single mask test, and
+// lookups elsewhere only re-descend from the lowest ancestor shared with the previous lookup. This
+// makes spatially coherent access (stencil sweeps, neighbour probes) much cheaper than At.
+//
+// The accessor keeps a reference to the tree and must not outlive it. Regenerating or editing the
+// tree invalidates the cache; call Reset afterwards.
+class VoxelTreeAccessor
+{
+public:
+    explicit VoxelTreeAccessor(const SparseVoxelTree& tree);
+
+    uint8_t At(int32_t x, int32_t y, int32_t z);
+
+    // Drops the cached path so the next lookup starts from the root.
+    void Reset();
+
+private:
+    static constexpr int32_t MaxDepth = SparseVoxelTree::MaxRootScale / 2;
+
+    const SparseVoxelTree& tree;
+
+    // Nodes on the path to the last looked up position, root first. Entries up to cachedDepth are valid.
+    const SparseVoxelTreeNode* nodes[MaxDepth];
+    int32_t cachedDepth;
+    glm::ivec3 cachedPos;
+};
@@ -1,7 +1,7 @@
 #include "voxel_tree_memory_allocator.h"
 
 VoxelTreeMemoryAllocator::VoxelTreeMemoryAllocator()
-    : treeBuffer(0), nodePoolBuffer(0), leafDataBuffer(0) {}
+    : treeBuffer(0), nodePoolBuffer(0), leafDataBuffer(0), nodeMaterialBuffer(0) {}
 
 VoxelTreeMemoryAllocator::~VoxelTreeMemoryAllocator()
 {
@@ -13,6 +13,7 @@ void VoxelTreeMemoryAllocator::Allocate(const std::vector<SparseVoxelTree>& voxe
     gpuTrees.clear();
     gpuNodePool.clear();
     gpuLeafData.clear();
+    gpuNodeMaterials.clear();
 
     uint32_t nodeOffset = 0;
     uint32_t leafOffset = 0;
@@ -29,10 +30,11 @@ void VoxelTreeMemoryAllocator::PackVoxelTree(const SparseVoxelTree& tree, uint32
 
     // Convert Root Node
     GPUSparseVoxelTreeNode gpuRoot;
-    gpuRoot.PackedData[0] = (tree.root.IsLeaf << 31) | tree.root.ChildPtr;
+    gpuRoot.PackedData[0] = (tree.root.IsLeaf << 31) | (tree.root.IsSolid << 30) | tree.root.ChildPtr;
     gpuRoot.PackedData[1] = static_cast<uint32_t>(tree.root.ChildMask);
     gpuRoot.PackedData[2] = static_cast<uint32_t>(tree.root.ChildMask >> 32);
     gpuTree.Root = gpuRoot;
+    gpuTree.RootScale = tree.rootScale;
 
     // Set AABB and Transform
     gpuTree.Bounds.Min = glm::vec4(tree.AABBMin, 0);
@@ -50,12 +52,18 @@ void VoxelTreeMemoryAllocator::PackVoxelTree(const SparseVoxelTree& tree, uint32
     for (const auto& node : tree.nodePool)
     {
         GPUSparseVoxelTreeNode gpuNode;
-        gpuNode.PackedData[0] = (node.IsLeaf << 31) | node.ChildPtr;
+        gpuNode.PackedData[0] = (node.IsLeaf << 31) | (node.IsSolid << 30) | node.ChildPtr;
         gpuNode.PackedData[1] = static_cast<uint32_t>(node.ChildMask);
         gpuNode.PackedData[2] = static_cast<uint32_t>(node.ChildMask >> 32);
         gpuNodePool.push_back(gpuNode);
     }
 
+    // Append Node Materials (zero when the tree has no level of detail table)
+    for (size_t i = 0; i < tree.nodePool.size(); ++i)
+    {
+        gpuNodeMaterials.push_back(tree.HasLodTable() ? tree.GetNodeMaterial(i) : 0);
+    }
+
     // Append Leaf Data
     gpuLeafData.insert(gpuLeafData.end(), tree.leafData.begin(), tree.leafData.end());
 
@@ -81,6 +89,11 @@ void VoxelTreeMemoryAllocator::UploadToGPU()
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, leafDataBuffer);
     glBufferData(GL_SHADER_STORAGE_BUFFER, gpuLeafData.size() * sizeof(uint32_t), gpuLeafData.data(), GL_STATIC_DRAW);
 
+    // Upload Node Materials
+    glGenBuffers(1, &nodeMaterialBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeMaterialBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gpuNodeMaterials.size() * sizeof(uint32_t), gpuNodeMaterials.data(), GL_STATIC_DRAW);
+
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
@@ -89,6 +102,7 @@ void VoxelTreeMemoryAllocator::FreeGPUResources()
     if (treeBuffer) glDeleteBuffers(1, &treeBuffer);
     if (nodePoolBuffer) glDeleteBuffers(1, &nodePoolBuffer);
     if (leafDataBuffer) glDeleteBuffers(1, &leafDataBuffer);
+    if (nodeMaterialBuffer) glDeleteBuffers(1, &nodeMaterialBuffer);
 
-    treeBuffer = nodePoolBuffer = leafDataBuffer = 0;
+    treeBuffer = nodePoolBuffer = leafDataBuffer = nodeMaterialBuffer = 0;
 }
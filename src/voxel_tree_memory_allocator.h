@@ -25,17 +25,20 @@ public:
     GLuint GetTreeBuffer() const { return treeBuffer; }
     GLuint GetNodePoolBuffer() const { return nodePoolBuffer; }
     GLuint GetLeafDataBuffer() const { return leafDataBuffer; }
+    GLuint GetNodeMaterialBuffer() const { return nodeMaterialBuffer; }
 
     // Get Data
     const std::vector<GPUSparseVoxelTree> GetTreeBufferData() const { return gpuTrees; }
     const std::vector<GPUSparseVoxelTreeNode> GetNodePoolBufferData() const { return gpuNodePool; }
     const std::vector<uint32_t> GetLeafDataBufferData() const { return gpuLeafData; }
+    const std::vector<uint32_t> GetNodeMaterialBufferData() const { return gpuNodeMaterials; }
 
     void PrintStats()
     {
         std::cout << "GPU Sparse Voxel Trees: " << gpuTrees.size() * sizeof(GPUSparseVoxelTree) << std::endl;
         std::cout << "GPU Node Pool: " << gpuNodePool.size() * sizeof(GPUSparseVoxelTreeNode) << std::endl;
         std::cout << "GPU Leaf Data: " << gpuLeafData.size() * sizeof(uint32_t) << std::endl;
+        std::cout << "GPU Node Materials: " << gpuNodeMaterials.size() * sizeof(uint32_t) << std::endl;
     }
 
     void PrintMemory() const
@@ -49,6 +52,7 @@ public:
             std::cout << "Tree " << i << ":\n";
             std::cout << "  NodePoolPtr: " << tree.NodePoolPtr << "\n";
             std::cout << "  LeafDataPtr: " << tree.LeafDataPtr << "\n";
+            std::cout << "  RootScale: " << tree.RootScale << "\n";
             std::cout << "  AABBMin: (" << tree.Bounds.Min.x << ", " << tree.Bounds.Min.y << ", " << tree.Bounds.Min.z << ", " << tree.Bounds.Min.w << ")\n";
             std::cout << "  AABBMax: (" << tree.Bounds.Max.x << ", " << tree.Bounds.Max.y << ", " << tree.Bounds.Max.z << ", " << tree.Bounds.Max.w << ")\n";
         }
@@ -81,6 +85,9 @@ public:
         if (gpuTree.Bounds.Min != glm::vec4(tree.GetAABBMin(), 0) || gpuTree.Bounds.Max != glm::vec4(tree.GetAABBMax(), 0) || gpuTree.Transform != tree.GetTransform())
             return false;
 
+        if (gpuTree.RootScale != static_cast<uint32_t>(tree.GetRootScale()))
+            return false;
+
         if (gpuTree.NodePoolPtr >= gpuNodePool.size() || gpuTree.LeafDataPtr >= gpuLeafData.size())
             return false;
 
@@ -91,7 +98,7 @@ public:
             const auto& gpuNode = gpuNodePool[gpuTree.NodePoolPtr + i];
             const auto& treeNode = tree.nodePool[i];
 
-            uint32_t packedData0 = (treeNode.IsLeaf << 31) | treeNode.ChildPtr;
+            uint32_t packedData0 = (treeNode.IsLeaf << 31) | (treeNode.IsSolid << 30) | treeNode.ChildPtr;
             uint32_t packedData1 = static_cast<uint32_t>(treeNode.ChildMask);
             uint32_t packedData2 = static_cast<uint32_t>(treeNode.ChildMask >> 32);
 
@@ -105,6 +112,13 @@ public:
                 return false;
         }
 
+        for (size_t i = 0; i < tree.nodePool.size(); ++i)
+        {
+            uint32_t material = tree.HasLodTable() ? tree.GetNodeMaterial(i) : 0;
+            if (gpuTree.NodePoolPtr + i >= gpuNodeMaterials.size() || gpuNodeMaterials[gpuTree.NodePoolPtr + i] != material)
+                return false;
+        }
+
         return true;
     }
 
@@ -112,10 +126,12 @@ private:
     GLuint treeBuffer;      // GPU buffer for GPUSparseVoxelTrees
     GLuint nodePoolBuffer;  // GPU buffer for node pools
     GLuint leafDataBuffer;  // GPU buffer for leaf data
+    GLuint nodeMaterialBuffer; // GPU buffer for representative node materials, parallel to the node pool
 
     std::vector<GPUSparseVoxelTree> gpuTrees;
     std::vector<GPUSparseVoxelTreeNode> gpuNodePool;
     std::vector<uint32_t> gpuLeafData;
+    std::vector<uint32_t> gpuNodeMaterials;
 
     void PackVoxelTree(const SparseVoxelTree& tree, uint32_t& nodeOffset, uint32_t& leafOffset);
 };
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "work_stealing_pool.h"
+#include <algorithm>
+
+namespace
+{
+    uint64_t packRange(uint32_t begin, uint32_t end)
+    {
+        return static_cast<uint64_t>(end) << 32 | begin;
+    }
+}
+
+WorkStealingPool::WorkStealingPool(uint32_t threadCount)
+    : threadCount(threadCount != 0 ? threadCount : std::max(std::thread::hardware_concurrency(), 1u)),
+      shares(new Share[this->threadCount])
+{
+    for (uint32_t i = 0; i < this->threadCount; ++i)
+    {
+        shares[i].Range.store(0, std::memory_order_relaxed);
+    }
+
+    workers.reserve(this->threadCount - 1);
+    for (uint32_t i = 1; i < this->threadCount; ++i)
+    {
+        workers.emplace_back(&WorkStealingPool::workerMain, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    startCondition.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t thread)>& func)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < threadCount; ++i)
+    {
+        uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * i / threadCount);
+        uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(count) * (i + 1) / threadCount);
+        shares[i].Range.store(packRange(begin, end), std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &func;
+        busyWorkers = threadCount - 1;
+        ++generation;
+    }
+    startCondition.notify_all();
+
+    run(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void WorkStealingPool::workerMain(uint32_t thread)
+{
+    uint64_t seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        startCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+        if (stopping)
+        {
+            return;
+        }
+        seenGeneration = generation;
+
+        lock.unlock();
+        run(thread);
+        lock.lock();
+
+        if (--busyWorkers == 0)
+        {
+            doneCondition.notify_one();
+        }
+    }
+}
+
+void WorkStealingPool::run(uint32_t thread)
+{
+    const std::function<void(uint32_t, uint32_t)>& func = *job;
+
+    // Indices only move from a share to an empty one, so once no share has any left every index has
+    // been claimed by some thread, which finishes it before it returns
+    do
+    {
+        uint32_t index;
+        while (popFront(thread, index))
+        {
+            func(index, thread);
+        }
+    } while (steal(thread));
+}
+
+bool WorkStealingPool::popFront(uint32_t thread, uint32_t& index)
+{
+    std::atomic<uint64_t>& range = shares[thread].Range;
+    uint64_t current = range.load(std::memory_order_acquire);
+    while (true)
+    {
+        uint32_t begin = static_cast<uint32_t>(current);
+        uint32_t end = static_cast<uint32_t>(current >> 32);
+        if (begin >= end)
+        {
+            return false;
+        }
+
+        if (range.compare_exchange_weak(current, packRange(begin + 1, end), std::memory_order_acq_rel))
+        {
+            index = begin;
+            return true;
+        }
+    }
+}
+
+bool WorkStealingPool::steal(uint32_t thief)
+{
+    // Victims are visited starting right after the thief, so thieves spread over different shares
+    for (uint32_t i = 1; i < threadCount; ++i)
+    {
+        std::atomic<uint64_t>& range = shares[(thief + i) % threadCount].Range;
+        uint64_t current = range.load(std::memory_order_acquire);
+        while (true)
+        {
+            uint32_t begin = static_cast<uint32_t>(current);
+            uint32_t end = static_cast<uint32_t>(current >> 32);
+            if (begin >= end)
+            {
+                break;
+            }
+
+            uint32_t split = end - (end - begin + 1) / 2;
+            if (range.compare_exchange_weak(current, packRange(begin, split), std::memory_order_acq_rel))
+            {
+                shares[thief].Range.store(packRange(split, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run ParallelFor loops with work stealing.
+//
+// Every loop splits its indices into one contiguous share per thread, so each thread walks neighbouring
+// indices in order. A thread that finishes its share steals the back half of another thread's remaining
+// indices. A share is a [begin, end) pair packed into one atomic word: the owner takes indices off the front
+// and thieves split off the back, both with a single compare-and-swap.
+//
+// The thread calling ParallelFor works as thread 0, so a pool of one thread runs everything inline.
+class WorkStealingPool
+{
+public:
+    // 0 uses one thread per hardware thread
+    explicit WorkStealingPool(uint32_t threadCount = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Calls func(index, thread) for every index in [0, count) and returns once all calls have finished.
+    // `thread` is in [0, GetThreadCount()) and unique among the calls running at the same time, for
+    // per-thread scratch data. Must not be called from inside func.
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t thread)>& func);
+
+    uint32_t GetThreadCount() const { return threadCount; }
+
+private:
+    struct alignas(64) Share
+    {
+        std::atomic<uint64_t> Range; // begin in the low 32 bits, end in the high 32 bits
+    };
+
+    uint32_t threadCount;
+    std::unique_ptr<Share[]> shares;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+    const std::function<void(uint32_t, uint32_t)>* job = nullptr;
+    uint64_t generation = 0;
+    uint32_t busyWorkers = 0;
+    bool stopping = false;
+
+    void workerMain(uint32_t thread);
+    void run(uint32_t thread);
+    bool popFront(uint32_t thread, uint32_t& index);
+    bool steal(uint32_t thief);
+};